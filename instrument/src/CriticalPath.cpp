@@ -24,11 +24,13 @@
 #include "analysis/timestamp/ConstantWorkOpHandler.h"
 #include "analysis/timestamp/LiveInHandler.h"
 #include "analysis/ControlDependence.h"
+#include "analysis/NonEscapingAllocas.h"
 #include "analysis/WorkAnalysis.h"
 #include "TimestampPlacer.h"
 #include "StoreInstHandler.h"
 #include "CallableHandler.h"
 #include "DynamicMemoryHandler.h"
+#include "MemoryTransferHandler.h"
 #include "PhiHandler.h"
 #include "FunctionArgsHandler.h"
 #include "ReturnHandler.h"
@@ -157,10 +159,12 @@ struct CriticalPath : public ModulePass
             ConstantWorkOpHandler const_work_op_handler(ts_analysis, placer, induc_vars);
             ts_analysis.registerHandler(const_work_op_handler);
 
-            LoadHandler lh(placer);
+            NonEscapingAllocas allocas(func, inst_ids);
+
+            LoadHandler lh(placer, allocas);
             placer.registerHandler(lh);
 
-            StoreInstHandler sih(placer);
+            StoreInstHandler sih(placer, allocas);
             placer.registerHandler(sih);
 
             CallableHandler<CallInst> cih(placer);
@@ -185,6 +189,11 @@ struct CriticalPath : public ModulePass
 			ignored.push_back("realloc");
 			ignored.push_back("free");
 
+			// ignore bulk memory functions (see MemoryTransferHandler)
+			ignored.push_back("memcpy");
+			ignored.push_back("memmove");
+			ignored.push_back("memset");
+
 			// ignore C++ exception handling functions
 			ignored.push_back("__cxa_allocate_exception");
 			ignored.push_back("__cxa_throw");
@@ -202,6 +211,9 @@ struct CriticalPath : public ModulePass
             DynamicMemoryHandler dmh(placer);
             placer.registerHandler(dmh);
 
+            MemoryTransferHandler mth(placer);
+            placer.registerHandler(mth);
+
             FunctionArgsHandler func_args(placer);
             placer.registerHandler(func_args);
 
@@ -101,8 +101,13 @@ void DynamicMemoryHandler::handle(llvm::Instruction& inst)
 		LOG_DEBUG() << "adding return value of inst as arg to _KMalloc\n";
 		args.push_back(&call_inst);
 
-		// insert size (arg 0 of func)
+		// insert size (arg 0 of malloc, nmemb * size for calloc)
 		Value* sizeOperand = call_inst.getArgOperand(0);
+		if (called_func->getName().compare("calloc") == 0) {
+			sizeOperand = BinaryOperator::Create(Instruction::Mul,
+				call_inst.getArgOperand(0), call_inst.getArgOperand(1),
+				"calloc_size", &call_inst);
+		}
 		LOG_DEBUG() << "pushing arg: " << PRINT_VALUE(*sizeOperand) << "\n";
 		args.push_back(sizeOperand);
 
@@ -178,6 +178,9 @@ namespace {
 			kremlib_calls.insert("_KLoad4");
 			kremlib_calls.insert("_KStore");
 			kremlib_calls.insert("_KStoreConst");
+			kremlib_calls.insert("_KMemCopy");
+			kremlib_calls.insert("_KMemSet");
+			kremlib_calls.insert("_KMemSetConst");
 			kremlib_calls.insert("_KMalloc");
 			kremlib_calls.insert("_KRealloc");
 			kremlib_calls.insert("_KFree");
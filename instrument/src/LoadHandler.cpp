@@ -17,8 +17,10 @@ using namespace std;
  * Constructs a new load handler.
  *
  * @param ts_placer The instruction placer this handler is associated with.
+ * @param allocas The stack slots shadowed in the virtual register table.
  */
-LoadHandler::LoadHandler(TimestampPlacer& ts_placer) :
+LoadHandler::LoadHandler(TimestampPlacer& ts_placer, NonEscapingAllocas& allocas) :
+    allocas(allocas),
     induc_vars(ts_placer.getAnalyses().li),
     ts_placer(ts_placer)
 {
@@ -55,6 +57,16 @@ LoadHandler::LoadHandler(TimestampPlacer& ts_placer) :
 
         args.push_back(types.i32());
     }
+
+    // Loads from stack slots in the register table are register moves.
+    args.clear();
+    args.push_back(types.i32()); // dest virtual reg num
+    args.push_back(types.i32()); // src reg num
+    args.push_back(types.i32()); // src timestamp
+	aref = new ArrayRef<Type*>(args);
+    FunctionType* move_func_type = FunctionType::get(types.voidTy(), *aref, false);
+	delete aref;
+    move_func = cast<Function>(m.getOrInsertFunction("_KTimestamp1", move_func_type));
 }
 
 const TimestampPlacerHandler::Opcodes& LoadHandler::getOpcodes()
@@ -68,6 +80,22 @@ void LoadHandler::handle(llvm::Instruction& inst)
     LLVMTypes types(load.getContext());
     vector<Value*> args;
 
+    // The loaded value is a copy of the slot's virtual register; all of the
+    // indices used to get to the slot are constant so there are no other
+    // dependencies.
+    if(allocas.isSlotAccess(*load.getPointerOperand()))
+    {
+        args.push_back(ConstantInt::get(types.i32(), ts_placer.getId(load), false)); // Dest ID
+        args.push_back(ConstantInt::get(types.i32(), allocas.getSlotId(*load.getPointerOperand()), false));
+        args.push_back(ConstantInt::get(types.i32(), 0, false));
+
+        ArrayRef<Value*> *aref = new ArrayRef<Value*>(args);
+        CallInst& ci = *CallInst::Create(move_func, *aref, "");
+        delete aref;
+        ts_placer.constrainInstPlacement(ci, load);
+        return;
+    }
+
 #if 0
     // Function that pushes an llvm int into args.
     function<void(unsigned int)> push_int = bind(&vector<Value*>::push_back,
@@ -3,6 +3,7 @@
 
 #include "TimestampPlacer.h"
 #include "TimestampPlacerHandler.h"
+#include "analysis/NonEscapingAllocas.h"
 
 /**
  * Handles inserting logLoadInst
@@ -10,7 +11,7 @@
 class LoadHandler : public TimestampPlacerHandler
 {
     public:
-    LoadHandler(TimestampPlacer& ts_placer);
+    LoadHandler(TimestampPlacer& ts_placer, NonEscapingAllocas& allocas);
     virtual ~LoadHandler() {}
 
     virtual const Opcodes& getOpcodes();
@@ -19,9 +20,11 @@ class LoadHandler : public TimestampPlacerHandler
     private:
     typedef std::map<size_t, llvm::Function*> SpecializedFuncs;
 
+    NonEscapingAllocas& allocas;
     InductionVariables induc_vars;
     Opcodes opcodes;
     llvm::Function* log_func;
+    llvm::Function* move_func;
     TimestampPlacer& ts_placer;
     SpecializedFuncs specialized_funcs;
 };
@@ -0,0 +1,156 @@
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Constants.h>
+#include "LLVMTypes.h"
+#include "foreach.h"
+#include "MemoryTransferHandler.h"
+
+// for untangle() function
+#include "CallableHandler.h"
+
+using namespace llvm;
+using namespace std;
+
+MemoryTransferHandler::MemoryTransferHandler(TimestampPlacer& ts_placer) :
+    log(PassLog::get()),
+    ts_placer(ts_placer)
+{
+    opcodes.push_back(Instruction::Call);
+
+    // Setup funcs
+    Module& m = *ts_placer.getFunc().getParent();
+    LLVMTypes types(m.getContext());
+    vector<Type*> args;
+
+	args.push_back(types.pi8());
+	args.push_back(types.pi8());
+	args.push_back(types.i64());
+
+	ArrayRef<Type*> *aref = new ArrayRef<Type*>(args);
+    FunctionType* mem_copy_call = FunctionType::get(types.voidTy(), *aref, false);
+	delete aref;
+    mem_copy_func = cast<Function>(m.getOrInsertFunction("_KMemCopy", mem_copy_call));
+
+	args.clear();
+
+	args.push_back(types.i32());
+	args.push_back(types.pi8());
+	args.push_back(types.i64());
+	aref = new ArrayRef<Type*>(args);
+    FunctionType* mem_set_call = FunctionType::get(types.voidTy(), *aref, false);
+	delete aref;
+    mem_set_func = cast<Function>(m.getOrInsertFunction("_KMemSet", mem_set_call));
+
+	args.clear();
+
+	args.push_back(types.pi8());
+	args.push_back(types.i64());
+	aref = new ArrayRef<Type*>(args);
+    FunctionType* mem_set_const_call = FunctionType::get(types.voidTy(), *aref, false);
+	delete aref;
+    mem_set_const_func = 
+		cast<Function>(m.getOrInsertFunction("_KMemSetConst", mem_set_const_call));
+}
+
+const TimestampPlacerHandler::Opcodes& MemoryTransferHandler::getOpcodes()
+{
+    return opcodes;
+}
+
+// Casts a pointer to i8* (if needed) right before the call.
+Value* MemoryTransferHandler::castToPointer(Value* val, Instruction& call) {
+    LLVMTypes types(call.getContext());
+	if (val->getType() == types.pi8()) return val;
+
+	CastInst* ptr_cast = CastInst::CreatePointerCast(val, types.pi8(), "mem_arg_ptr");
+	casts.push_back(ptr_cast);
+	return ptr_cast;
+}
+
+// Extends a length to i64 (if needed) right before the call.
+Value* MemoryTransferHandler::castToSize(Value* val, Instruction& call) {
+    LLVMTypes types(call.getContext());
+	if (val->getType() == types.i64()) return val;
+
+	CastInst* size_cast = CastInst::CreateIntegerCast(val, types.i64(), false, "mem_arg_size");
+	casts.push_back(size_cast);
+	return size_cast;
+}
+
+void MemoryTransferHandler::placeCall(CallInst& call, Instruction& inst) {
+	foreach(Instruction* cast_inst, casts)
+		ts_placer.constrainInstPlacement(*cast_inst, call);
+	casts.clear();
+
+    ts_placer.constrainInstPlacement(call, inst);
+}
+
+void MemoryTransferHandler::handle(llvm::Instruction& inst)
+{
+    CallInst& call_inst = *cast<CallInst>(&inst);
+    LLVMTypes types(call_inst.getContext());
+
+	Value* dest = NULL;
+	Value* src = NULL;	// NULL for memset
+	Value* set_val = NULL;
+	Value* len = NULL;
+
+	// llvm.memcpy / llvm.memmove / llvm.memset
+	if (MemTransferInst* transfer = dyn_cast<MemTransferInst>(&call_inst)) {
+		dest = transfer->getRawDest();
+		src = transfer->getRawSource();
+		len = transfer->getLength();
+	}
+	else if (MemSetInst* mem_set = dyn_cast<MemSetInst>(&call_inst)) {
+		dest = mem_set->getRawDest();
+		set_val = mem_set->getValue();
+		len = mem_set->getLength();
+	}
+	else {
+		// calls to the libc functions
+		Function *called_func = CallableHandler<CallInst>::untangleCall(call_inst);
+		if (called_func == NULL || called_func->isIntrinsic()) return;
+		if (call_inst.getNumArgOperands() != 3) return;
+
+		StringRef name = called_func->getName();
+		if (name.compare("memcpy") == 0 || name.compare("memmove") == 0) {
+			dest = call_inst.getArgOperand(0);
+			src = call_inst.getArgOperand(1);
+		}
+		else if (name.compare("memset") == 0) {
+			dest = call_inst.getArgOperand(0);
+			set_val = call_inst.getArgOperand(1);
+		}
+		else return;
+		len = call_inst.getArgOperand(2);
+	}
+
+	LOG_DEBUG() << "handling: " << inst << "\n";
+
+    vector<Value*> args;
+	Function* func_to_call = NULL;
+
+	if (src != NULL) {
+		args.push_back(castToPointer(dest, inst));
+		args.push_back(castToPointer(src, inst));
+		func_to_call = mem_copy_func;
+	}
+	else {
+		// like a store, the value's timestamp is only needed if it isn't a
+		// constant
+		if (!isa<Constant>(set_val))
+			args.push_back(ConstantInt::get(types.i32(), ts_placer.getId(*set_val)));
+		args.push_back(castToPointer(dest, inst));
+		func_to_call = isa<Constant>(set_val) ? mem_set_const_func : mem_set_func;
+	}
+	args.push_back(castToSize(len, inst));
+
+	ArrayRef<Value*> *aref = new ArrayRef<Value*>(args);
+    CallInst* mem_call = CallInst::Create(func_to_call, *aref, "");
+	delete aref;
+
+	placeCall(*mem_call, inst);
+	if (set_val != NULL && !isa<Constant>(set_val))
+    	ts_placer.requireValTimestampBeforeUser(*set_val, *mem_call);
+}
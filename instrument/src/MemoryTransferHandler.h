@@ -0,0 +1,38 @@
+#ifndef MEMORY_TRANSFER_HANDLER
+#define MEMORY_TRANSFER_HANDLER
+
+#include <vector>
+#include "TimestampPlacerHandler.h"
+#include "TimestampPlacer.h"
+#include "PassLog.h"
+
+/**
+ * Instruments memcpy, memmove and memset (both the LLVM intrinsics and
+ * calls to the libc functions) with a single _KMemCopy / _KMemSet call for
+ * the whole range.
+ */
+class MemoryTransferHandler : public TimestampPlacerHandler
+{
+    public:
+    MemoryTransferHandler(TimestampPlacer& ts_placer);
+    virtual ~MemoryTransferHandler() {};
+
+    virtual const Opcodes& getOpcodes();
+    virtual void handle(llvm::Instruction& inst);
+
+    private:
+	llvm::Value* castToPointer(llvm::Value* val, llvm::Instruction& call);
+	llvm::Value* castToSize(llvm::Value* val, llvm::Instruction& call);
+	void placeCall(llvm::CallInst& call, llvm::Instruction& inst);
+
+    PassLog& log;
+    llvm::Function* mem_copy_func;
+    llvm::Function* mem_set_func;
+    llvm::Function* mem_set_const_func;
+
+    Opcodes opcodes;
+    TimestampPlacer& ts_placer;
+	std::vector<llvm::Instruction*> casts; //!< casts made for the current call
+};
+
+#endif // MEMORY_TRANSFER_HANDLER
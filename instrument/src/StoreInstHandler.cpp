@@ -10,9 +10,13 @@ using namespace std;
 
 /**
  * Constructs a new handler for store instructions.
+ *
+ * @param timestamp_placer The instruction placer this handler is associated with.
+ * @param allocas The stack slots shadowed in the virtual register table.
  */
-StoreInstHandler::StoreInstHandler(TimestampPlacer& timestamp_placer) :
+StoreInstHandler::StoreInstHandler(TimestampPlacer& timestamp_placer, NonEscapingAllocas& allocas) :
     log(PassLog::get()),
+    allocas(allocas),
     timestampPlacer(timestamp_placer)
 {
     // Set up the opcodes
@@ -38,6 +42,21 @@ StoreInstHandler::StoreInstHandler(TimestampPlacer& timestamp_placer) :
     FunctionType* store_const_func_type = FunctionType::get(types.voidTy(), *aref, false);
 	delete aref;
     storeConstFunc = cast<Function>(module.getOrInsertFunction("_KStoreConst", store_const_func_type));
+
+	// Stores to stack slots in the register table are register moves.
+	func_param_types.clear();
+    func_param_types.push_back(types.i32());
+	aref = new ArrayRef<Type*>(func_param_types);
+    FunctionType* move_const_func_type = FunctionType::get(types.voidTy(), *aref, false);
+	delete aref;
+    moveConstFunc = cast<Function>(module.getOrInsertFunction("_KTimestamp0", move_const_func_type));
+
+    func_param_types.push_back(types.i32());
+    func_param_types.push_back(types.i32());
+	aref = new ArrayRef<Type*>(func_param_types);
+    FunctionType* move_reg_func_type = FunctionType::get(types.voidTy(), *aref, false);
+	delete aref;
+    moveRegFunc = cast<Function>(module.getOrInsertFunction("_KTimestamp1", move_reg_func_type));
 }
 
 /**
@@ -66,6 +85,26 @@ void StoreInstHandler::handle(llvm::Instruction& inst)
     // Get the ID for the source (if we're not storing a constant value)
     Value& src_val = *store_inst.getValueOperand();
 
+	// Stores to a stack slot in the register table just copy the source
+	// timestamp into the slot's virtual register.
+	if(allocas.isSlotAccess(*store_inst.getPointerOperand()))
+	{
+		call_args.push_back(ConstantInt::get(types.i32(),allocas.getSlotId(*store_inst.getPointerOperand())));
+		if(!isa<Constant>(src_val))
+		{
+			call_args.push_back(ConstantInt::get(types.i32(),timestampPlacer.getId(src_val)));
+			call_args.push_back(ConstantInt::get(types.i32(),0));
+		}
+
+		ArrayRef<Value*> *aref = new ArrayRef<Value*>(call_args);
+		CallInst& call_inst = *CallInst::Create(isa<Constant>(src_val) ? moveConstFunc : moveRegFunc, *aref, "");
+		delete aref;
+		timestampPlacer.constrainInstPlacement(call_inst, inst);
+		if(!isa<Constant>(src_val))
+			timestampPlacer.requireValTimestampBeforeUser(src_val, call_inst);
+		return;
+	}
+
 	if(!isa<Constant>(src_val))
     	call_args.push_back(ConstantInt::get(types.i32(),timestampPlacer.getId(src_val)));
 
@@ -3,13 +3,14 @@
 
 #include "TimestampPlacerHandler.h"
 #include "TimestampPlacer.h"
+#include "analysis/NonEscapingAllocas.h"
 #include <vector>
 #include "PassLog.h"
 
 class StoreInstHandler : public TimestampPlacerHandler
 {
     public:
-    StoreInstHandler(TimestampPlacer& timestamp_placer);
+    StoreInstHandler(TimestampPlacer& timestamp_placer, NonEscapingAllocas& allocas);
     virtual ~StoreInstHandler() {}
 
     virtual const std::vector<unsigned int>& getOpcodes();
@@ -17,8 +18,11 @@ class StoreInstHandler : public TimestampPlacerHandler
 
     private:
     PassLog& log;
+    NonEscapingAllocas& allocas;
     llvm::Function* storeRegFunc;
     llvm::Function* storeConstFunc;
+    llvm::Function* moveRegFunc;
+    llvm::Function* moveConstFunc;
     std::vector<unsigned int> opcodes;
     TimestampPlacer& timestampPlacer;
 };
@@ -0,0 +1,161 @@
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include "analysis/NonEscapingAllocas.h"
+#include "foreach.h"
+
+using namespace llvm;
+
+/**
+ * Finds the qualifying allocas of the function and assigns a virtual
+ * register to each element accessed in them.
+ *
+ * @param func      The function to analyze.
+ * @param inst_ids  The virtual register table index mapping of the function.
+ */
+NonEscapingAllocas::NonEscapingAllocas(llvm::Function& func, InstIds& inst_ids) :
+	log(PassLog::get())
+{
+    // Only the static allocas in the entry block are considered. Anything
+    // else may be executed more than once per call and then names more than
+    // one piece of memory.
+    foreach(Instruction& inst, func.getEntryBlock())
+    {
+        AllocaInst* alloca = dyn_cast<AllocaInst>(&inst);
+        if(!alloca || alloca->isArrayAllocation())
+            continue;
+
+        Accesses accesses;
+        if(!gatherAccesses(*alloca, ElementPath(), accesses) || accesses.empty())
+            continue;
+
+        std::map<ElementPath, unsigned int> path_ids;
+        for(Accesses::iterator it = accesses.begin(), it_end = accesses.end(); it != it_end; ++it)
+        {
+            std::map<ElementPath, unsigned int>::iterator path_id = path_ids.find(it->second);
+            if(path_id == path_ids.end())
+                path_id = path_ids.insert(std::make_pair(it->second, inst_ids.getNewId())).first;
+
+            slot_ids[it->first] = path_id->second;
+        }
+
+        LOG_DEBUG() << "shadowing " << path_ids.size() << " element(s) of " << *alloca << " in virtual registers\n";
+    }
+}
+
+/**
+ * @param ptr The pointer operand of a load or store.
+ * @return true if the access goes to an element with its own virtual
+ * register.
+ */
+bool NonEscapingAllocas::isSlotAccess(const llvm::Value& ptr) const
+{
+    return slot_ids.find(&ptr) != slot_ids.end();
+}
+
+/**
+ * @param ptr The pointer operand of a load or store.
+ * @return The virtual register of the element accessed through ptr.
+ * @pre isSlotAccess(ptr)
+ */
+unsigned int NonEscapingAllocas::getSlotId(const llvm::Value& ptr) const
+{
+    SlotIds::const_iterator it = slot_ids.find(&ptr);
+    assert(it != slot_ids.end());
+    return it->second;
+}
+
+/**
+ * Records all loads and stores through a pointer into an alloca along with
+ * the element they access.
+ *
+ * @param ptr       The alloca or a pointer derived from it.
+ * @param path      The constant indices that lead from the alloca to ptr.
+ * @param accesses  The pointers used by loads and stores so far.
+ * @return false if the address escapes or an access can't be pinned to a
+ * single scalar element.
+ */
+bool NonEscapingAllocas::gatherAccesses(const llvm::Value& ptr, const ElementPath& path, Accesses& accesses) const
+{
+    const Type* pointee_type = cast<PointerType>(ptr.getType())->getElementType();
+
+    for(Value::const_use_iterator ui = ptr.use_begin(), ue = ptr.use_end(); ui != ue; ++ui)
+    {
+        const User* user = *ui;
+
+        if(const LoadInst* load = dyn_cast<LoadInst>(user))
+        {
+            if(load->isVolatile() || !isScalarType(pointee_type))
+                return false;
+
+            accesses[&ptr] = path;
+        }
+        else if(const StoreInst* store = dyn_cast<StoreInst>(user))
+        {
+            // storing the address itself lets it escape
+            if(store->isVolatile() || store->getValueOperand() == &ptr || !isScalarType(pointee_type))
+                return false;
+
+            accesses[&ptr] = path;
+        }
+        else if(const GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(user))
+        {
+            if(gep->getPointerOperand() != &ptr)
+                return false;
+
+            // The first index steps over whole objects, so anything but 0
+            // leaves the alloca (or the element ptr points to).
+            User::const_op_iterator idx = gep->idx_begin();
+            const ConstantInt* first = dyn_cast<ConstantInt>(*idx);
+            if(!first || !first->isZero())
+                return false;
+
+            ElementPath gep_path(path);
+            for(++idx; idx != gep->idx_end(); ++idx)
+            {
+                const ConstantInt* ci = dyn_cast<ConstantInt>(*idx);
+                if(!ci)
+                    return false;
+
+                gep_path.push_back(ci->getZExtValue());
+            }
+
+            if(!gatherAccesses(*gep, gep_path, accesses))
+                return false;
+        }
+        else if(const BitCastInst* bc = dyn_cast<BitCastInst>(user))
+        {
+            // Front ends bracket locals with lifetime markers, which take
+            // an i8*. Those are fine; any other cast may be used to access
+            // the memory as a different type.
+            for(Value::const_use_iterator bc_ui = bc->use_begin(), bc_ue = bc->use_end(); bc_ui != bc_ue; ++bc_ui)
+            {
+                if(!isLifetimeMarker(**bc_ui))
+                    return false;
+            }
+        }
+        else if(!isLifetimeMarker(*user))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @return true if values of the type fit in one virtual register and have
+ * no elements that could be accessed separately.
+ */
+bool NonEscapingAllocas::isScalarType(const llvm::Type* type)
+{
+    return type->isIntegerTy() || type->isFloatingPointTy() || type->isPointerTy();
+}
+
+/**
+ * @return true if val is a call to llvm.lifetime.start or llvm.lifetime.end.
+ */
+bool NonEscapingAllocas::isLifetimeMarker(const llvm::Value& val)
+{
+    const IntrinsicInst* intrinsic = dyn_cast<IntrinsicInst>(&val);
+    return intrinsic &&
+        (intrinsic->getIntrinsicID() == Intrinsic::lifetime_start ||
+         intrinsic->getIntrinsicID() == Intrinsic::lifetime_end);
+}
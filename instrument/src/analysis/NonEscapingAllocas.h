@@ -0,0 +1,47 @@
+#ifndef NON_ESCAPING_ALLOCAS_H
+#define NON_ESCAPING_ALLOCAS_H
+
+#include <map>
+#include <vector>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include "ids/InstIds.h"
+#include "PassLog.h"
+
+/**
+ * Finds the stack slots of a function that can be shadowed in the virtual
+ * register table instead of in shadow memory.
+ *
+ * An alloca qualifies when its address never escapes the function and every
+ * access to it is a load or store of a scalar element at a constant position
+ * (i.e. through getelementptrs with only constant indices). Each distinct
+ * element accessed then gets its own virtual register, so a load from it is
+ * just a register move and a store to one element doesn't disturb the
+ * others. Allocas indexed with a variable stay in shadow memory: a single
+ * register for the whole array would make every element depend on every
+ * earlier store.
+ */
+class NonEscapingAllocas
+{
+    public:
+    NonEscapingAllocas(llvm::Function& func, InstIds& inst_ids);
+    virtual ~NonEscapingAllocas() {}
+
+    bool isSlotAccess(const llvm::Value& ptr) const;
+    unsigned int getSlotId(const llvm::Value& ptr) const;
+
+    private:
+    typedef std::vector<uint64_t> ElementPath;
+    typedef std::map<const llvm::Value*, ElementPath> Accesses;
+    typedef std::map<const llvm::Value*, unsigned int> SlotIds;
+
+    bool gatherAccesses(const llvm::Value& ptr, const ElementPath& path, Accesses& accesses) const;
+    static bool isScalarType(const llvm::Type* type);
+    static bool isLifetimeMarker(const llvm::Value& val);
+
+    SlotIds slot_ids;
+
+	PassLog& log;
+};
+
+#endif // NON_ESCAPING_ALLOCAS_H
@@ -41,4 +41,10 @@ unsigned int InstIds::getId(const llvm::Value& inst)
     return it->second;
 }
 
-
+/**
+ * @return A new unique id that isn't associated with any value.
+ */
+unsigned int InstIds::getNewId()
+{
+    return inst_ids++;
+}
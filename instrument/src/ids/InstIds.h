@@ -13,6 +13,7 @@ class InstIds
     virtual ~InstIds();
 
     unsigned int getId(const llvm::Value& inst);
+    unsigned int getNewId();
     size_t getCount() const;
 
 	IdMap getIdMap();
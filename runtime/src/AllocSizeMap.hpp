@@ -0,0 +1,129 @@
+#ifndef _ALLOCSIZEMAP_HPP_
+#define _ALLOCSIZEMAP_HPP_
+
+#include <cassert>
+#include <vector>
+#include "ktypes.h"
+
+/*!
+ * @brief Remembers the size of each live heap allocation.
+ *
+ * free() only gets the address of a block, so the size _KMalloc saw is
+ * kept here until the block is freed. Entries live in a single array
+ * searched with linear probing on the block address; removal shifts later
+ * entries back instead of leaving tombstones, so lookups stay short no
+ * matter how many blocks a program allocates and frees. The table doubles
+ * once it is half full and never shrinks.
+ */
+class AllocSizeMap {
+private:
+	class Slot {
+	public:
+		Addr addr;		//!< start of the block (NULL if the slot is empty)
+		UInt64 size;	//!< bytes requested for the block
+	};
+
+	static const unsigned INIT_NUM_SLOTS = 1024; // must be a power of 2
+
+	std::vector<Slot> slots;
+	UInt64 num_entries;
+
+	static unsigned hash(Addr addr) {
+		// malloc'd blocks are at least 8 byte aligned
+		UInt64 key = (UInt64)addr >> 3;
+		return (UInt32)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+	}
+
+	unsigned getSlotMask() { return slots.size() - 1; }
+
+	unsigned findSlot(Addr addr) {
+		unsigned i = hash(addr) & getSlotMask();
+		while (slots[i].addr != NULL && slots[i].addr != addr)
+			i = (i + 1) & getSlotMask();
+		return i;
+	}
+
+	/*! @brief Doubles the number of slots and re-inserts all entries. */
+	void grow() {
+		std::vector<Slot> old_slots;
+		old_slots.swap(slots);
+		Slot empty = {NULL, 0};
+		slots.assign(old_slots.size() * 2, empty);
+		for (unsigned i = 0; i < old_slots.size(); ++i) {
+			if (old_slots[i].addr != NULL)
+				slots[findSlot(old_slots[i].addr)] = old_slots[i];
+		}
+	}
+
+public:
+	AllocSizeMap() : num_entries(0) {}
+
+	void init() {
+		Slot empty = {NULL, 0};
+		slots.assign(INIT_NUM_SLOTS, empty);
+		num_entries = 0;
+	}
+
+	void deinit() {
+		std::vector<Slot>().swap(slots);
+		num_entries = 0;
+	}
+
+	UInt64 getNumEntries() { return num_entries; }
+
+	/*!
+	 * Records the size of a block, replacing the old size if the block is
+	 * already known.
+	 *
+	 * @param addr The start of the block.
+	 * @param size The size of the block in bytes.
+	 * @pre addr is non-NULL.
+	 */
+	void insert(Addr addr, UInt64 size) {
+		assert(addr != NULL);
+		unsigned i = findSlot(addr);
+		if (slots[i].addr == NULL) {
+			if ((num_entries + 1) * 2 > slots.size()) {
+				grow();
+				i = findSlot(addr);
+			}
+			slots[i].addr = addr;
+			++num_entries;
+		}
+		slots[i].size = size;
+	}
+
+	/*!
+	 * Forgets a block.
+	 *
+	 * @param addr The start of the block.
+	 * @param[out] size Set to the size of the block if it was known.
+	 * @return false if there was no entry for addr (e.g. the block came
+	 * from an uninstrumented allocation).
+	 */
+	bool remove(Addr addr, UInt64* size) {
+		unsigned i = findSlot(addr);
+		if (slots[i].addr == NULL) return false;
+		*size = slots[i].size;
+
+		// move later entries of the probe sequence into the hole unless
+		// that would put them before their home slot
+		unsigned hole = i;
+		unsigned j = i;
+		while (true) {
+			j = (j + 1) & getSlotMask();
+			if (slots[j].addr == NULL) break;
+			unsigned home = hash(slots[j].addr) & getSlotMask();
+			if (((j - home) & getSlotMask()) >= ((j - hole) & getSlotMask())) {
+				slots[hole] = slots[j];
+				hole = j;
+			}
+		}
+		slots[hole].addr = NULL;
+		slots[hole].size = 0;
+		--num_entries;
+		return true;
+	}
+};
+
+#endif // _ALLOCSIZEMAP_HPP_
@@ -11,11 +11,24 @@ protected:
 	MShadowSkadu *mem_shadow;
 
 public:
+	virtual ~CacheInterface() {}
+
 	virtual void init(int size, bool compress, MShadowSkadu* mshadow) = 0;
 	virtual void deinit() = 0;
 
 	virtual void set(Addr addr, Index size, Version* vArray, Time* tArray, TimeTable::TableType type) = 0;
 	virtual Time* get(Addr addr, Index size, Version* vArray, TimeTable::TableType type) = 0;
+
+	/*!
+	 * Drops every cached word in [addr, addr+size) without writing it back.
+	 */
+	virtual void invalidate(Addr addr, UInt64 size) = 0;
+
+	/*!
+	 * Writes back and drops every cached word in [addr, addr+size), so
+	 * shadow memory holds the current timestamps of the range.
+	 */
+	virtual void flushRange(Addr addr, UInt64 size, Version* vArray) = 0;
 };
 
 #endif // _CACHEINTERFACE_HPP_
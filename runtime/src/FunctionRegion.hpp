@@ -11,6 +11,8 @@ private:
 	Reg return_register;
 	CID call_site_id;
 	UInt32 error_checking_code;
+	Addr frame_base; //!< lowest stack pointer seen at one of its regions
+	Addr caller_stack_ptr; //!< caller's stack pointer at the call (or NULL)
 
 public:
 	Table* table; // TODO: make this private
@@ -20,8 +22,10 @@ public:
 		this->return_register = r; 
 	}
 
-	FunctionRegion(CID callsite_id) { 
+	FunctionRegion(CID callsite_id, Addr frame_base, Addr caller_stack_ptr) { 
 		this->table = NULL;
+		this->frame_base = frame_base;
+		this->caller_stack_ptr = caller_stack_ptr;
 		this->return_register = FunctionRegion::DUMMY_RETURN_REG;
 		this->error_checking_code = FunctionRegion::ERROR_CHECK_CODE;
 		this->call_site_id = callsite_id;
@@ -35,6 +39,17 @@ public:
 
 	CID getCallSiteID() { return this->call_site_id; }
 	Reg getReturnRegister() { return this->return_register; }
+	Addr getFrameBase() { return this->frame_base; }
+	Addr getCallerStackPointer() { return this->caller_stack_ptr; }
+
+	/*!
+	 * Notes the function's stack pointer at one of its inner regions, so
+	 * stack it allocates after entry (e.g. with alloca) counts as its frame.
+	 */
+	void lowerFrameBase(Addr stack_ptr) {
+		if ((char*)stack_ptr < (char*)this->frame_base)
+			this->frame_base = stack_ptr;
+	}
 	Table* getTable() { return this->table; }
 
 	void sanityCheck() {
@@ -1,3 +1,6 @@
+#include <string.h> // for memcpy
+#include <vector>
+
 #include "debug.h"
 #include "config.h"
 #include "KremlinProfiler.hpp"
@@ -9,8 +12,10 @@
 
 Table *KremlinProfiler::shadow_reg_file = NULL;
 
-void KremlinProfiler::addFunctionToStack(CID callsite_id) {
-	FunctionRegion* func = new FunctionRegion(callsite_id);
+void KremlinProfiler::addFunctionToStack(CID callsite_id, Addr frame_base, 
+											Addr caller_stack_ptr) {
+	FunctionRegion* func = 
+		new FunctionRegion(callsite_id, frame_base, caller_stack_ptr);
 	callstack.push_back(func);
 
 	MSG(3, "addFunctionToStack at 0x%x CID 0x%x\n", func, callsite_id);
@@ -395,7 +400,38 @@ void KremlinProfiler::timestampUpdaterStore(Addr dest_addr, UInt32 mem_access_si
 }
 
 
-void KremlinProfiler::handleRegionEntry(SID regionId, RegionType regionType) {
+/*
+ * A memset behaves like a store of the same value to every word of the
+ * range; all of those stores can happen at the same time.
+ */
+template <bool store_const>
+void KremlinProfiler::timestampUpdaterMemSet(Addr dest_addr, UInt64 size, Reg src_reg) {
+	UInt64 num_words = (((UInt64)dest_addr + size + 7) >> 3) - ((UInt64)dest_addr >> 3);
+	increaseTime(num_words * STORE_COST);
+
+	Time* dest_times = getLevelTimes();
+
+	Index end_index = getCurrNumInstrumentedLevels();
+    for (Index index = 0; index < end_index; ++index) {
+		Level i = getLevelForIndex(index);
+		ProgramRegion* region = getRegionAtLevel(i);
+
+		Time control_dep_time = getControlDependenceAtIndex(index);
+        Time dest_time = control_dep_time + STORE_COST;
+		if (!store_const) {
+			Time src_time = getRegisterTimeAtIndex(src_reg, index);
+        	dest_time = MAX(control_dep_time,src_time) + STORE_COST;
+		}
+		dest_times[index] = dest_time;
+        region->updateCriticalPathLength(dest_time);
+    }
+
+	Level min_level = getLevelForIndex(0);
+	getShadowMemory()->fill(dest_addr, size, end_index, getVersionAtLevel(min_level), dest_times);
+}
+
+
+void KremlinProfiler::handleRegionEntry(SID regionId, RegionType regionType, Addr stack_ptr) {
 	iDebugHandlerRegionEntry(regionId);
 	idbgAction(KREM_REGION_ENTRY,"## KEnterRegion(regionID=%llu,regionType=%u)\n",regionId,regionType);
 
@@ -419,12 +455,17 @@ void KremlinProfiler::handleRegionEntry(SID regionId, RegionType regionType) {
 	// func region allocates a new RShadow Table.
 	// for other region types, it needs to "clean" previous region's timestamps
     if(regionType == RegionFunc) {
-        addFunctionToStack(getLastCallsiteID());
+        addFunctionToStack(getLastCallsiteID(), stack_ptr, 
+							getLastCallStackPointer());
+		// a function entered from uninstrumented code mustn't reuse it
+		setLastCallStackPointer(NULL);
         waitForRegisterTableSetup();
 
     } else {
 		if (shouldInstrumentCurrLevel())
 			zeroRegistersAtIndex(getCurrentLevelIndex());
+		if (!callstackIsEmpty())
+			getCurrentFunction()->lowerFrameBase(stack_ptr);
 	}
 
     FunctionRegion* funcHead = getCurrentFunction();
@@ -468,7 +509,33 @@ static RegionStats fillRegionStats(UInt64 work, UInt64 cp, CID callSiteId, UInt6
 /**
  * Does the clean up work when exiting a function region.
  */
-void KremlinProfiler::handleFunctionExit() {
+void KremlinProfiler::clearStackFrame(Addr stack_ptr) {
+	assert(!callstackIsEmpty());
+
+	// the root function's frame lives until the program ends
+	if (callstack.size() < 2) return;
+
+	// Everything below the caller's stack pointer at the call belongs to
+	// this function. The caller's frame base isn't a safe bound: stack the
+	// caller allocated since its last region boundary (e.g. a VLA) lies
+	// below it and is still live.
+	FunctionRegion* func = callstack.back();
+	char* low = (char*)func->getFrameBase();
+	if (stack_ptr != NULL && (char*)stack_ptr < low) low = (char*)stack_ptr;
+	char* high = (char*)func->getCallerStackPointer();
+
+	// e.g. a function entered while profiling was off or from uninstrumented
+	// code, or one running on a signal or coroutine stack
+	if (low == NULL || high <= low || (UInt64)(high - low) > MAX_STACK_FRAME_SIZE)
+		return;
+
+	MSG(1, "clear stack frame 0x%llx - 0x%llx\n", low, high);
+	Level min_level = getLevelForIndex(0);
+	getShadowMemory()->clear(low, high - low, getVersionAtLevel(min_level));
+}
+
+void KremlinProfiler::handleFunctionExit(Addr stack_ptr) {
+	if (stack_ptr != NULL) clearStackFrame(stack_ptr);
 	callstackPop();
 
 	// root function
@@ -482,7 +549,7 @@ void KremlinProfiler::handleFunctionExit() {
 	setRegisterFileTable(funcHead->table); 
 }
 
-void KremlinProfiler::handleRegionExit(SID regionId, RegionType regionType) {
+void KremlinProfiler::handleRegionExit(SID regionId, RegionType regionType, Addr stack_ptr) {
 	idbgAction(KREM_REGION_EXIT, "## KExitRegion(regionID=%llu,regionType=%u)\n",regionId,regionType);
 
     if (!enabled) return; 
@@ -564,14 +631,17 @@ void KremlinProfiler::handleRegionExit(SID regionId, RegionType regionType) {
 	closeRegionContext(&stats);
         
     if (regionType == RegionFunc) { 
-		handleFunctionExit(); 
+		handleFunctionExit(stack_ptr); 
+	}
+	else if (stack_ptr != NULL) {
+		getCurrentFunction()->lowerFrameBase(stack_ptr);
 	}
 
     decrementLevel();
 	MSG(0, "\n");
 }
 
-void KremlinProfiler::handleLandingPad(SID regionId, RegionType regionType) {
+void KremlinProfiler::handleLandingPad(SID regionId, RegionType regionType, Addr stack_ptr) {
 	idbgAction(KREM_REGION_EXIT, "## KLandingPad(regionID=%llu,regionType=%u)\n",regionId,regionType);
 
     if (!enabled) return;
@@ -665,8 +735,9 @@ void KremlinProfiler::handleLandingPad(SID regionId, RegionType regionType) {
 							spWork, is_doall, region);
 		closeRegionContext(&stats);
 			
+		// frames unwound to get here are all below the landing pad's
 		if (region->regionType == RegionFunc) { 
-			handleFunctionExit(); 
+			handleFunctionExit(stack_ptr); 
 		}
 
 		decrementLevel();
@@ -894,6 +965,170 @@ void KremlinProfiler::handleStoreConst(Addr dest_addr, UInt32 mem_access_size) {
     MSG(1, "store const mem[0x%x] completed\n", dest_addr);
 }
 
+void KremlinProfiler::handleMalloc(Addr addr, size_t size) {
+    MSG(1, "KMalloc addr=0x%x size=%llu\n", addr, (UInt64)size);
+	idbgAction(KREM_MALLOC,"## _KMalloc(addr=0x%x,size=%llu)\n",addr,(UInt64)size);
+
+    if (!enabled) return;
+
+    // Don't do anything if malloc returned NULL
+    if (addr == NULL) return;
+
+	alloc_sizes.insert(addr, size);
+}
+
+void KremlinProfiler::handleFree(Addr addr) {
+    MSG(1, "KFree addr=0x%x\n", addr);
+	idbgAction(KREM_FREE,"## _KFree(addr=0x%x)\n",addr);
+
+    if (!enabled) return;
+
+    // Calls to free with NULL just return.
+    if (addr == NULL) return;
+
+	// blocks allocated before profiling started have no size to go on
+	UInt64 size;
+	if (!alloc_sizes.remove(addr, &size)) return;
+
+	// whatever reuses this memory shouldn't depend on the old stores
+	Level min_level = getLevelForIndex(0);
+	getShadowMemory()->clear(addr, size, getVersionAtLevel(min_level));
+}
+
+void KremlinProfiler::moveShadowTimes(Addr dest, Addr src, UInt64 size) {
+	Index depth = getCurrNumInstrumentedLevels();
+	if (depth == 0) return;
+
+	Level min_level = getLevelForIndex(0);
+	Version* versions = getVersionAtLevel(min_level);
+	Time* times = getLevelTimes();
+	MShadow* shadow = getShadowMemory();
+	UInt64 grain = shadow->getGranularity();
+
+	UInt64 offset = 0;
+	while (offset < size) {
+		// the source bytes landing in this destination granule may span
+		// two source granules if the blocks are aligned differently
+		UInt64 granule = ((UInt64)dest + offset) & ~(grain - 1);
+		UInt64 next = MIN(granule + grain - (UInt64)dest, size);
+		Addr first = (char*)src + offset;
+		Addr last = (char*)src + next - 1;
+		offset = next;
+
+		// the cache may hand back the same buffer for the next access
+		Time* src_times = shadow->get(first, depth, versions, 8);
+		memcpy(times, src_times, sizeof(Time) * depth);
+		if ((((UInt64)first ^ (UInt64)last) & ~(grain - 1)) != 0) {
+			src_times = shadow->get(last, depth, versions, 8);
+			for (Index i = 0; i < depth; ++i) 
+				times[i] = MAX(times[i], src_times[i]);
+		}
+
+		// skip granules that were never written so they don't get shadow pages
+		Index i = 0;
+		while (i < depth && times[i] == 0) ++i;
+		if (i == depth) continue;
+
+		// a granule bigger than a word may also hold other data, whose
+		// timestamps stay
+		Time* dest_times = shadow->get((Addr)granule, depth, versions, 8);
+		for (i = 0; i < depth; ++i) times[i] = MAX(times[i], dest_times[i]);
+		shadow->set((Addr)granule, depth, versions, times, 8);
+	}
+}
+
+void KremlinProfiler::handleRealloc(Addr old_addr, Addr new_addr, size_t size) {
+    MSG(1, "KRealloc old_addr=0x%x new_addr=0x%x size=%llu\n", old_addr, new_addr, (UInt64)size);
+	idbgAction(KREM_REALLOC,"## _KRealloc(old_addr=0x%x,new_addr=0x%x,size=%llu)\n",old_addr,new_addr,(UInt64)size);
+
+    if (!enabled) return;
+
+	// realloc(NULL, size) is malloc
+	if (old_addr == NULL) {
+		handleMalloc(new_addr, size);
+		return;
+	}
+
+	// on failure the old block is untouched (unless size was 0, in which
+	// case it was freed)
+	if (new_addr == NULL) {
+		if (size == 0) handleFree(old_addr);
+		return;
+	}
+
+	UInt64 old_size = 0;
+	bool known = alloc_sizes.remove(old_addr, &old_size);
+	alloc_sizes.insert(new_addr, size);
+	if (!known) return;
+
+	Level min_level = getLevelForIndex(0);
+	if (new_addr == old_addr) {
+		// leave the granule holding the new end alone
+		UInt64 grain = getShadowMemory()->getGranularity();
+		UInt64 kept = ((UInt64)size + grain - 1) & ~(grain - 1);
+		if (kept < old_size) {
+			getShadowMemory()->clear((char*)old_addr + kept, old_size - kept, 
+										getVersionAtLevel(min_level));
+		}
+		return;
+	}
+
+	// the contents moved, so their timestamps move with them
+	moveShadowTimes(new_addr, old_addr, MIN(old_size, (UInt64)size));
+	getShadowMemory()->clear(old_addr, old_size, getVersionAtLevel(min_level));
+}
+
+void KremlinProfiler::handleMemCopy(Addr dest_addr, Addr src_addr, UInt64 size) {
+    MSG(1, "KMemCopy ts[0x%x] = ts[0x%x] size=%llu\n", dest_addr, src_addr, size);
+	idbgAction(KREM_MEMCOPY,"## _KMemCopy(dest_addr=0x%x,src_addr=0x%x,size=%llu)\n",dest_addr,src_addr,size);
+
+    if (!enabled) return;
+	if (size == 0) return;
+
+	// every word is loaded and stored, all of them at the same time
+	UInt64 num_words = (((UInt64)dest_addr + size + 7) >> 3) - ((UInt64)dest_addr >> 3);
+	increaseTime(num_words * (LOAD_COST + STORE_COST));
+
+	Index end_index = getCurrNumInstrumentedLevels();
+	if (end_index == 0) return;
+
+	Time* control_dep_times = getLevelTimes();
+    for (Index index = 0; index < end_index; ++index) {
+		control_dep_times[index] = getControlDependenceAtIndex(index);
+	}
+
+	std::vector<Time> max_times(end_index);
+	Level min_level = getLevelForIndex(0);
+	getShadowMemory()->copy(dest_addr, src_addr, size, end_index, 
+							getVersionAtLevel(min_level), control_dep_times, 
+							LOAD_COST + STORE_COST, &max_times[0]);
+
+    for (Index index = 0; index < end_index; ++index) {
+		ProgramRegion* region = getRegionAtLevel(getLevelForIndex(index));
+        region->updateCriticalPathLength(max_times[index]);
+	}
+}
+
+void KremlinProfiler::handleMemSet(Reg src_reg, Addr dest_addr, UInt64 size) {
+    MSG(1, "KMemSet ts[0x%x] = ts[%u] size=%llu\n", dest_addr, src_reg, size);
+	idbgAction(KREM_MEMSET,"## _KMemSet(src_reg=%u,dest_addr=0x%x,size=%llu)\n",src_reg,dest_addr,size);
+
+    if (!enabled) return;
+	if (size == 0) return;
+
+	timestampUpdaterMemSet<false>(dest_addr, size, src_reg);
+}
+
+void KremlinProfiler::handleMemSetConst(Addr dest_addr, UInt64 size) {
+    MSG(1, "KMemSetConst ts[0x%x] = %u size=%llu\n", dest_addr, STORE_COST, size);
+	idbgAction(KREM_MEMSET,"## _KMemSetConst(dest_addr=0x%x,size=%llu)\n",dest_addr,size);
+
+    if (!enabled) return;
+	if (size == 0) return;
+
+	timestampUpdaterMemSet<true>(dest_addr, size, 0);
+}
+
 void KremlinProfiler::handlePhi(Reg dest_reg, Reg src_reg, UInt32 num_ctrls, va_list args) {
     MSG(1, "KPhi ts[%u] = max(ts[%u],ts[ctrl0]...ts[ctrl%u])\n", dest_reg, src_reg,num_ctrls);
 	idbgAction(KREM_PHI,"## KPhi (dest_reg=%u,src_reg=%u,num_ctrls=%u)\n",dest_reg,src_reg,num_ctrls);
@@ -1024,7 +1259,7 @@ void KremlinProfiler::handlePopCDep() {
 	cdt_current_base = control_dependence_table->getElementAddr(cdt_read_ptr, 0);
 }
 
-void KremlinProfiler::handlePrepCall(CID callSiteId, UInt64 calledRegionId) {
+void KremlinProfiler::handlePrepCall(CID callSiteId, UInt64 calledRegionId, Addr stack_ptr) {
 	MSG(3, "KPrepCall(callSiteId=%llx, calledRegionId=%llx)\n", callSiteId, calledRegionId);
 	idbgAction(KREM_PREP_CALL, "## _KPrepCall(callSiteId=%llu,calledRegionId=%llu)\n",callSiteId,calledRegionId);
     if (!enabled) return; 
@@ -1034,6 +1269,7 @@ void KremlinProfiler::handlePrepCall(CID callSiteId, UInt64 calledRegionId) {
     // theirs off. 
     clearFunctionArgQueue();
 	setLastCallsiteID(callSiteId);
+	setLastCallStackPointer(stack_ptr);
 }
 
 #define DUMMY_ARG		-1
@@ -1185,6 +1421,7 @@ void KremlinProfiler::init() {
 	initRegionTree();
 
 	initShadowMemory();
+	alloc_sizes.init();
 	initProgramRegions(INIT_NUM_REGIONS);
 }
 
@@ -1197,7 +1434,7 @@ void KremlinProfiler::cleanup() {
     Level level = getCurrentLevel();
 	for (int i = level; i >= 0; --i) {
 		ProgramRegion* region = getRegionAtLevel(i);
-		handleRegionExit(region->regionId, region->regionType);
+		handleRegionExit(region->regionId, region->regionType, NULL);
 	}
 }
 
@@ -1216,6 +1453,7 @@ void KremlinProfiler::deinit() {
 	printProfiledData(kremlin_config.getProfileOutputFilename());
 	deinitRegionTree();
 	deinitShadowMemory();
+	alloc_sizes.deinit();
 	deinitFunctionArgQueue();
 	deinitControlDependences();
 	deinitProgramRegions();
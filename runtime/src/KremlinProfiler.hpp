@@ -5,6 +5,7 @@
 #include <stdarg.h> /* for variable length args */
 #include "ktypes.h"
 #include "PoolAllocator.hpp"
+#include "AllocSizeMap.hpp"
 
 #define MIN(a, b)   (((a) < (b)) ? (a) : (b))
 #define MAX(a, b)   (((a) > (b)) ? (a) : (b))
@@ -42,6 +43,7 @@ private:
 	std::vector<FunctionRegion*, MPoolLib::PoolAllocator<FunctionRegion*> > callstack;
 
 	CID last_callsite_id;
+	Addr last_call_stack_ptr; //!< caller's stack pointer at the last _KPrepCall
 
 	static const unsigned int FUNC_ARG_QUEUE_SIZE = 64;
 	std::vector<Reg> function_arg_queue;
@@ -94,6 +96,12 @@ private:
 	Time* getLevelTimes() { return level_times; }
 	Version* getVersionAtLevel(Level level) { return &level_versions[level]; }
 
+	/*!
+	 * Starts a new epoch at the given level. Versions come from a single
+	 * counter, so the versions of the active levels strictly increase with
+	 * depth; shadow memory relies on this to find stale levels quickly (see
+	 * LevelVersions.h).
+	 */
 	void issueVersionToLevel(Level level) {
 		level_versions[level] = nextVersion++;	
 	}
@@ -129,6 +137,18 @@ private:
 	static Table *shadow_reg_file;
 	MShadow *shadow_mem;
 
+	AllocSizeMap alloc_sizes; // sizes of live heap blocks, needed on free
+
+	/*!
+	 * Copies the timestamps of every granule in [src, src+size) that was
+	 * written at some level to the same offset from dest. Each destination
+	 * granule keeps the later of its own and the copied timestamps, as it
+	 * may be shared with other data.
+	 *
+	 * @pre src and dest are word aligned.
+	 */
+	void moveShadowTimes(Addr dest, Addr src, UInt64 size);
+
 	/*!
 	 * @brief Returns number of shadow registers in the current function.
 	 *
@@ -288,12 +308,35 @@ private:
 	template <bool store_const>
 	void timestampUpdaterStore(Addr dest_addr, UInt32 mem_access_size, Reg src_reg);
 
+	template <bool store_const>
+	void timestampUpdaterMemSet(Addr dest_addr, UInt64 size, Reg src_reg);
+
 	/*!
 	 * Pushes new function region  onto function call stack.
 	 *
+	 * @param callsite_id The callsite that called the function.
+	 * @param frame_base The stack pointer when the function entered its
+	 * region.
+	 * @param caller_stack_ptr The caller's stack pointer at the call, or
+	 * NULL if the call wasn't prepared with _KPrepCall.
 	 * @post Function call stack will not be empty.
 	 */
-	void addFunctionToStack(CID callsite_id);
+	void addFunctionToStack(CID callsite_id, Addr frame_base, 
+							Addr caller_stack_ptr);
+
+	//! Frames larger than this are assumed to be on a different stack.
+	static const UInt64 MAX_STACK_FRAME_SIZE = 8 * 1024 * 1024;
+
+	/*!
+	 * Drops the shadow memory of the current function's stack frame, which
+	 * is dead once the function returns. The frame reaches from the lowest
+	 * stack pointer seen in the function up to the caller's stack pointer
+	 * at the call; nothing is cleared if the latter is unknown.
+	 *
+	 * @param stack_ptr The stack pointer as the function leaves its region.
+	 * @pre Callstack is not empty.
+	 */
+	void clearStackFrame(Addr stack_ptr);
 
 	/*!
 	 * Pops function region from callstack
@@ -321,6 +364,7 @@ public:
 		max_active_level(0),
 		curr_num_instrumented_levels(0),
 		instrument_curr_level(false),
+		last_call_stack_ptr(NULL),
 		waiting_for_register_table_init(false),
 		num_function_regions_entered(0),
 		num_register_tables_setup(0),
@@ -387,6 +431,8 @@ public:
 	Level getLevelForIndex(Index index) { return min_level + index; }
 
 	void setLastCallsiteID(CID cs_id) { this->last_callsite_id = cs_id; }
+	Addr getLastCallStackPointer() { return this->last_call_stack_ptr; }
+	void setLastCallStackPointer(Addr sp) { this->last_call_stack_ptr = sp; }
 	void increaseTime(UInt32 amount) { curr_time += amount; } // XXX: UInt32 -> Time?
 
 	void incrementLevel() { 
@@ -458,10 +504,10 @@ public:
 	void initShadowMemory();
 	void deinitShadowMemory();
 
-	void handleRegionEntry(SID regionId, RegionType regionType);
-	void handleRegionExit(SID regionId, RegionType regionType);
-	void handleFunctionExit();
-	void handleLandingPad(SID regionId, RegionType regionType);
+	void handleRegionEntry(SID regionId, RegionType regionType, Addr stack_ptr);
+	void handleRegionExit(SID regionId, RegionType regionType, Addr stack_ptr);
+	void handleFunctionExit(Addr stack_ptr);
+	void handleLandingPad(SID regionId, RegionType regionType, Addr stack_ptr);
 	void handleAssignConst(UInt dest_reg);
 	void handleInduction(UInt dest_reg);
 	void handleReduction(UInt op_cost, Reg dest_reg);
@@ -487,6 +533,12 @@ public:
 	void handleLoad1(Addr src_addr, Reg dest_reg, Reg src_reg, UInt32 mem_access_size);
 	void handleStore(Reg src_reg, Addr dest_addr, UInt32 mem_access_size);
 	void handleStoreConst(Addr dest_addr, UInt32 mem_access_size);
+	void handleMalloc(Addr addr, size_t size);
+	void handleFree(Addr addr);
+	void handleRealloc(Addr old_addr, Addr new_addr, size_t size);
+	void handleMemCopy(Addr dest_addr, Addr src_addr, UInt64 size);
+	void handleMemSet(Reg src_reg, Addr dest_addr, UInt64 size);
+	void handleMemSetConst(Addr dest_addr, UInt64 size);
 	void handlePhi(Reg dest_reg, Reg src_reg, UInt32 num_ctrls, va_list args);
 	void handlePhi1To1(Reg dest_reg, Reg src_reg, Reg ctrl_reg);
 	void handlePhi2To1(Reg dest_reg, Reg src_reg, Reg ctrl1_reg, Reg ctrl2_reg);
@@ -498,7 +550,7 @@ public:
 	void handlePopCDep();
 	void handlePushCDep(Reg cond);
 
-	void handlePrepCall(CID callSiteId, UInt64 calledRegionId);
+	void handlePrepCall(CID callSiteId, UInt64 calledRegionId, Addr stack_ptr);
 	void handleEnqueueArgument(Reg src);
 	void handleEnqueueConstArgument();
 	void handleDequeueArgument(Reg dest);
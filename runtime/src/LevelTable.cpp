@@ -1,4 +1,5 @@
 #include <cassert>
+#include <vector>
 #include "debug.h"
 #include "ktypes.h"
 #include "MShadowStat.h" // for mshadow event counters
@@ -13,26 +14,144 @@ void LevelTable::operator delete(void* ptr) {
 	MemPoolFreeSmall(ptr, sizeof(LevelTable));
 }
 
-LevelTable::LevelTable() : code(0xDEADBEEF) {
-	memset(this->versions, 0, LevelTable::MAX_LEVEL * sizeof(Version));
-	memset(this->time_tables, 0, LevelTable::MAX_LEVEL * sizeof(TimeTable*));
-}
+LevelTable::LevelTable() : levels(NULL), num_levels(0), word_times(NULL), 
+							compressed(false), code(0xDEADBEEF), 
+							gc_prev(NULL), gc_next(NULL), in_gc_list(false), 
+							clock_prev(NULL), clock_next(NULL), 
+							clock_ref(false), in_active_set(false), 
+							compress_state(CBuffer::COMPRESS_IDLE) {}
 
 LevelTable::~LevelTable() {
-	for (unsigned i = 0; i < LevelTable::MAX_LEVEL; ++i) {
-		TimeTable *t = time_tables[i];
-		if (t != NULL) {
-			delete t;
-			t = NULL;
+	for (unsigned i = 0; i < num_levels; ++i) {
+		if (levels[i].table != NULL)
+			freeTimeTable(i);
+	}
+
+	if (word_times != NULL) {
+		freeWordTimes(word_times, num_levels);
+		word_times = NULL;
+	}
+
+	if (levels != NULL) {
+		MemPoolFreeSmall(levels, GetLevelStorageSize(num_levels));
+		levels = NULL;
+	}
+	eventLevelTableResize(num_levels, 0);
+}
+
+void LevelTable::growLevels(Index new_num_levels) {
+	assert(new_num_levels > num_levels);
+
+	LevelEntry* new_levels = 
+		(LevelEntry*)MemPoolAllocSmall(GetLevelStorageSize(new_num_levels));
+	if (levels != NULL) {
+		memcpy(new_levels, levels, GetLevelStorageSize(num_levels));
+		MemPoolFreeSmall(levels, GetLevelStorageSize(num_levels));
+	}
+	memset(&new_levels[num_levels], 0, 
+			GetLevelStorageSize(new_num_levels - num_levels));
+
+	// address-major blocks are strided by the number of levels so they
+	// have to be laid out again
+	if (word_times != NULL) {
+		Time* new_word_times = allocWordTimes(new_num_levels);
+		unsigned num_words = TimeTable::GetNumEntries(TimeTable::TYPE_64BIT);
+		for (unsigned i = 0; i < num_words; ++i) {
+			memcpy(&new_word_times[i * new_num_levels], 
+					&word_times[i * num_levels], sizeof(Time) * num_levels);
 		}
+		freeWordTimes(word_times, num_levels);
+		word_times = new_word_times;
 	}
+
+	eventLevelTableResize(num_levels, new_num_levels);
+	levels = new_levels;
+	num_levels = new_num_levels;
 }
 
-Time LevelTable::getTimeForAddrAtLevel(Index level, Addr addr, Version curr_ver) {
-	assert(level < LevelTable::MAX_LEVEL);
+Time* LevelTable::allocWordTimes(Index depth) {
+	unsigned num_words = TimeTable::GetNumEntries(TimeTable::TYPE_64BIT);
+	UInt64 level_size = sizeof(Time) * num_words;
+	Time* block = (Time*)MemPoolAllocSmall(level_size * depth);
+	assert(block != NULL);
+	memset(block, 0, level_size * depth);
+
+	// account for the block as one 64-bit TimeTable per level so the
+	// garbage collection period means the same thing in both layouts
+	for (unsigned i = 0; i < depth; ++i) {
+		eventTimeTableAlloc(TimeTable::TYPE_64BIT, level_size);
+	}
+	return block;
+}
+
+void LevelTable::freeWordTimes(Time* block, Index depth) {
+	assert(block != NULL);
+	unsigned num_words = TimeTable::GetNumEntries(TimeTable::TYPE_64BIT);
+	UInt64 level_size = sizeof(Time) * num_words;
+	for (unsigned i = 0; i < depth; ++i) {
+		eventTimeTableFree(TimeTable::TYPE_64BIT, level_size);
+	}
+	MemPoolFreeSmall(block, level_size * depth);
+}
+
+void LevelTable::cleanWordTimesAtLevel(Index level) {
+	assert(word_times != NULL);
+	assert(level < num_levels);
+	unsigned num_words = TimeTable::GetNumEntries(TimeTable::TYPE_64BIT);
+	for (unsigned i = 0; i < num_words; ++i) {
+		word_times[i * num_levels + level] = 0;
+	}
+}
+
+void LevelTable::getTimesForAddr(Addr addr, Index size, 
+									Version *curr_versions, Time *times) {
+	assert(curr_versions != NULL);
+	assert(times != NULL);
+
+	if (word_times == NULL) {
+		memset(times, 0, sizeof(Time) * size);
+		return;
+	}
+
+	Time* word = &word_times[GetWordIndex(addr) * num_levels];
+	for (Index i = 0; i < size; ++i) {
+		bool valid = i < num_levels && levels[i].version == curr_versions[i];
+		times[i] = valid ? word[i] : 0;
+	}
+}
+
+void LevelTable::setTimesForAddr(Addr addr, Index size, 
+									Version *curr_versions, Time *times) {
+	assert(curr_versions != NULL);
+	assert(times != NULL);
 
+	if (size < 1) return;
+
+	this->reserveLevels(size);
+
+	// a new block is already clean at every level
+	bool fresh = (word_times == NULL);
+	if (fresh) word_times = allocWordTimes(num_levels);
+
+	for (Index i = 0; i < size; ++i) {
+		eventLevelWrite(i);
+		if (fresh) {
+			levels[i].version = curr_versions[i];
+		}
+		else if (levels[i].version != curr_versions[i]) {
+			// level is out of date so clean it and reuse
+			cleanWordTimesAtLevel(i);
+			levels[i].version = curr_versions[i];
+		}
+	}
+
+	Time* word = &word_times[GetWordIndex(addr) * num_levels];
+	memcpy(word, times, sizeof(Time) * size);
+}
+
+Time LevelTable::getTimeForAddrAtLevel(Index level, Addr addr, Version curr_ver) {
 	TimeTable *table = this->getTimeTableAtLevel(level);
-	Version stored_ver = this->versions[level];
+	Version stored_ver = this->getVersionAtLevel(level);
 
 	Time ret = 0;
 	if (table != NULL && stored_ver == curr_ver) {
@@ -47,7 +166,7 @@ Time LevelTable::getTimeForAddrAtLevel(Index level, Addr addr, Version curr_ver)
 void LevelTable::setTimeForAddrAtLevel(Index level, Addr addr, 
 										Version curr_ver, Time value, 
 										TimeTable::TableType type) {
-	assert(level < LevelTable::MAX_LEVEL);
+	this->reserveLevels(level + 1);
 
 	TimeTable *table = this->getTimeTableAtLevel(level);
 	Version stored_ver = this->getVersionAtLevel(level);
@@ -87,43 +206,174 @@ unsigned LevelTable::findLowestInvalidIndex(Version *curr_versions) {
 	assert(curr_versions != NULL);
 
 	unsigned lowest_valid = 0;
-	while(lowest_valid < LevelTable::MAX_LEVEL 
-		&& this->time_tables[lowest_valid] != NULL 
-		&& this->versions[lowest_valid] >= curr_versions[lowest_valid]) {
+	while(lowest_valid < num_levels 
+		&& this->levels[lowest_valid].table != NULL 
+		&& this->levels[lowest_valid].version >= curr_versions[lowest_valid]) {
 		++lowest_valid;
 	}
 
-	assert(lowest_valid < LevelTable::MAX_LEVEL); // TODO: should be exception
 	return lowest_valid;
 }
 
+void LevelTable::freeTimeTable(Index level) {
+	TimeTable *t = this->levels[level].table;
+	assert(t != NULL);
+
+	// a compressed table's array is a payload from the compressor
+	if (isCompressed()) {
+		freeCompressedData((UInt8*)t->array, t->size);
+		t->array = NULL;
+	}
+	delete t;
+	this->levels[level].table = NULL;
+}
+
 void LevelTable::cleanTimeTablesFromLevel(Index start_level) {
-	for(unsigned i = start_level; i < LevelTable::MAX_LEVEL; ++i) {
-		TimeTable *t = this->time_tables[i];
-		if (t != NULL) {
-			delete t;
-			t = NULL;
-			this->time_tables[i] = NULL;
+	for(unsigned i = start_level; i < num_levels; ++i) {
+		if (this->levels[i].table != NULL)
+			freeTimeTable(i);
+	}
+}
+
+void LevelTable::getTimesInRange(Addr start, Addr end, Index size, 
+									Version *curr_versions, Time *times) {
+	assert(curr_versions != NULL);
+	assert(times != NULL);
+
+	unsigned first_word = GetWordIndex(start);
+	unsigned num_words = ((UInt64)end - (UInt64)start) >> 3;
+
+	for (Index i = 0; i < size; ++i) {
+		Time* row = &times[i * num_words];
+		bool valid = i < num_levels && levels[i].version == curr_versions[i];
+
+		if (valid && word_times != NULL) {
+			for (unsigned w = 0; w < num_words; ++w) {
+				row[w] = word_times[(first_word + w) * num_levels + i];
+			}
+			continue;
+		}
+
+		TimeTable* table = valid ? levels[i].table : NULL;
+		if (table == NULL) {
+			memset(row, 0, sizeof(Time) * num_words);
+		}
+		else if (table->type == TimeTable::TYPE_64BIT) {
+			memcpy(row, &table->array[table->getIndex(start)], 
+					sizeof(Time) * num_words);
+		}
+		else {
+			for (unsigned w = 0; w < num_words; ++w) {
+				row[w] = table->getTimeAtAddr((char*)start + 8 * w);
+			}
+		}
+	}
+}
+
+void LevelTable::setTimesInRange(Addr start, Addr end, Index size, 
+									Version *curr_versions, Time *times) {
+	assert(curr_versions != NULL);
+	assert(times != NULL);
+	assert(word_times == NULL);
+	assert(!isCompressed());
+
+	unsigned num_words = ((UInt64)end - (UInt64)start) >> 3;
+	this->reserveLevels(size);
+
+	for (Index i = 0; i < size; ++i) {
+		Time* row = &times[i * num_words];
+		TimeTable* table = levels[i].table;
+		eventLevelWrite(i);
+
+		if (table == NULL) {
+			table = new TimeTable(TimeTable::TYPE_64BIT);
+			levels[i].table = table;
+			eventTimeTableNewAlloc(i, TimeTable::TYPE_64BIT);
+		}
+		else if (levels[i].version != curr_versions[i]) {
+			// exists but version is old so clean it and reuse
+			table->clean();
+		}
+		levels[i].version = curr_versions[i];
+
+		if (table->type == TimeTable::TYPE_64BIT) {
+			memcpy(&table->array[table->getIndex(start)], row, 
+					sizeof(Time) * num_words);
+		}
+		else {
+			for (unsigned w = 0; w < num_words; ++w) {
+				table->setTimeAtAddr((char*)start + 8 * w, row[w], 
+										TimeTable::TYPE_64BIT);
+			}
+		}
+	}
+}
+
+void LevelTable::clearTimesInRange(Addr start, Addr end) {
+	assert(!isCompressed());
+	assert(start < end);
+
+	unsigned num_words = TimeTable::GetNumEntries(TimeTable::TYPE_64BIT);
+	unsigned first_word = GetWordIndex(start);
+	unsigned end_word = GetWordIndex((char*)end - 1) + 1;
+	assert(end_word > first_word);
+
+	if (first_word == 0 && end_word == num_words) {
+		cleanTimeTablesFromLevel(0);
+		if (word_times != NULL) {
+			freeWordTimes(word_times, num_levels);
+			word_times = NULL;
+		}
+		for (unsigned i = 0; i < num_levels; ++i) {
+			levels[i].version = 0;
 		}
+		return;
+	}
+
+	for (unsigned i = 0; i < num_levels; ++i) {
+		TimeTable* table = levels[i].table;
+		if (table == NULL) continue;
+		unsigned first = table->getIndex(start);
+		unsigned last = table->getIndex((char*)end - 1);
+		memset(&table->array[first], 0, sizeof(Time) * (last - first + 1));
+	}
+
+	if (word_times != NULL) {
+		memset(&word_times[first_word * num_levels], 0, 
+				sizeof(Time) * num_levels * (end_word - first_word));
 	}
 }
 
+bool LevelTable::hasTimes() {
+	if (word_times != NULL) return true;
+	for (unsigned i = 0; i < num_levels; ++i) {
+		if (levels[i].table != NULL) return true;
+	}
+	return false;
+}
+
 void LevelTable::collectGarbageWithinBounds(Version *curr_versions, 
 											unsigned end_index) {
 	assert(curr_versions != NULL);
-	assert(end_index < LevelTable::MAX_LEVEL);
 
-	for (unsigned i = 0; i < end_index; ++i) {
-		TimeTable *table = this->time_tables[i];
+	// Versions increase with depth, so when level 0 is stale all levels are.
+	if (word_times != NULL && levels[0].version < curr_versions[0]) {
+		freeWordTimes(word_times, num_levels);
+		word_times = NULL;
+		for (unsigned i = 0; i < num_levels; ++i) {
+			levels[i].version = 0;
+		}
+	}
+
+	for (unsigned i = 0; i < end_index && i < num_levels; ++i) {
+		TimeTable *table = this->levels[i].table;
 		if (table == NULL)
 			continue;
 
-		Version ver = this->versions[i];
+		Version ver = this->levels[i].version;
 		if (ver < curr_versions[i]) {
 			// out of date
-			delete table;
-			table = NULL;
-			this->time_tables[i] = NULL;
+			freeTimeTable(i);
 		}
 	}
 
@@ -137,13 +387,18 @@ void LevelTable::collectGarbageUnbounded(Version *curr_versions) {
 	this->cleanTimeTablesFromLevel(lii);
 }
 
-UInt64 LevelTable::compress() {
+static void retireArray(Time* array, std::vector<Time*>* retired_arrays) {
+	if (retired_arrays != NULL) retired_arrays->push_back(array);
+	else MemPoolFree(array);
+}
+
+UInt64 LevelTable::compress(std::vector<Time*>* retired_arrays) {
 	assert(this->code == 0xDEADBEEF);
 	assert(!isCompressed());
 
 	MSG(4,"compressing LevelTable (addr: 0x%p)\n", this);
 
-	TimeTable* tt1 = this->time_tables[0];
+	TimeTable* tt1 = this->getTimeTableAtLevel(0);
 
 	if (tt1 == NULL) {
 		this->compressed = true;
@@ -154,13 +409,13 @@ UInt64 LevelTable::compress() {
 	lzo_uint srcLen = sizeof(Time)*TimeTable::TIMETABLE_SIZE/2; // XXX assumes 8 bytes
 	lzo_uint compLen = 0;
 
-	Time* diffBuffer = (Time*)MemPoolAlloc();
+	Time diffBuffer[TimeTable::TIMETABLE_SIZE/2];
 	void* compressedData;
 
-	for(unsigned i = LevelTable::MAX_LEVEL-1; i >=1; --i) {
+	for(unsigned i = num_levels-1; i >=1; --i) {
 		// step 1: create/fill in time difference table
-		TimeTable* tt2 = this->time_tables[i];
-		TimeTable* ttPrev = this->time_tables[i-1];
+		TimeTable* tt2 = this->levels[i].table;
+		TimeTable* ttPrev = this->levels[i-1].table;
 		if(tt2 == NULL)
 			continue;
 
@@ -179,23 +434,16 @@ UInt64 LevelTable::compress() {
 		tt2->size = compLen;
 
 		// step 3: profit
-		MemPoolFree(tt2->array); // XXX: comment this out if using tArrayBackup
+		retireArray(tt2->array, retired_arrays); // XXX: comment this out if using tArrayBackup
 		tt2->array = (Time*)compressedData;
 	}
-	Time* level0Array = (Time*)MemPoolAlloc();
-	memcpy(level0Array, tt1->array, srcLen);
 	makeDiff(tt1->array);
 	compressedData = compressData((UInt8*)tt1->array, srcLen, &compLen);
-	MemPoolFree(tt1->array);
-	//Time* level0Array = tt1->array;
+	retireArray(tt1->array, retired_arrays);
 	tt1->array = (Time*)compressedData;
 	tt1->size = compLen;
 	compressionSavings += (srcLen - compLen);
 
-
-	MemPoolFree(level0Array);  // XXX: comment this out if using tArrayBackup
-	MemPoolFree(diffBuffer);
-
 	this->compressed = true;
 
 	assert(isCompressed());
@@ -213,7 +461,7 @@ UInt64 LevelTable::decompress() {
 	lzo_uint uncompLen = srcLen;
 
 	// for now, we'll always diff based on level 0
-	TimeTable* tt1 = this->time_tables[0];
+	TimeTable* tt1 = this->getTimeTableAtLevel(0);
 	if (tt1 == NULL) {
 		this->compressed = false;
 		return 0;
@@ -232,9 +480,9 @@ UInt64 LevelTable::decompress() {
 
 	Time *diffBuffer = (Time*)MemPoolAlloc();
 
-	for(unsigned i = 1; i < LevelTable::MAX_LEVEL; ++i) {
-		TimeTable* tt2 = this->time_tables[i];
-		TimeTable* ttPrev = this->time_tables[i-1];
+	for(unsigned i = 1; i < num_levels; ++i) {
+		TimeTable* tt2 = this->levels[i].table;
+		TimeTable* ttPrev = this->levels[i-1].table;
 		if(tt2 == NULL) 
 			break;
 
@@ -294,11 +542,10 @@ void LevelTable::restoreDiff(Time *array) {
 
 unsigned LevelTable::getDepth() {
 	// TODO: assert for NULL TimeTable* precondition
-	for (unsigned i = 0; i < LevelTable::MAX_LEVEL; ++i) {
-		TimeTable* t = this->time_tables[i];
+	for (unsigned i = 0; i < num_levels; ++i) {
+		TimeTable* t = this->levels[i].table;
 		if (t == NULL)
 			return i;
 	}
-	assert(0);
-	return -1;
+	return num_levels;
 }
@@ -2,22 +2,99 @@
 #define _LEVELTABLE_HPP_
 
 #include <cassert>
+#include <vector>
 #include "ktypes.h"
 #include "TimeTable.hpp" // for TimeTable::TableType
 
-//TODO: need to support dynamically growing / shrinking without MAX_LEVEL
+/*!
+ * @brief The version and TimeTable associated with a single level.
+ */
+class LevelEntry {
+public:
+	Version version;	//!< version of the TimeTable at this level
+	TimeTable* table;	//!< TimeTable for this level (may be NULL)
+};
+
+/*!
+ * @brief Per-page shadow memory, with one TimeTable for each level.
+ *
+ * Storage for levels is sized to the deepest level that has been written
+ * and grows on demand, so shallow profiles don't pay for unused levels.
+ *
+ * Timestamps are stored in one of two layouts, chosen by the caller:
+ * - level-major: one TimeTable per level (the *AtLevel methods).
+ * - address-major: a single block in which all levels of a word are
+ *   contiguous (the *TimesForAddr methods). Versions are still per level.
+ * A given LevelTable should only ever be accessed with one of the two.
+ */
 class LevelTable {
 private:
-	static const unsigned MAX_LEVEL = 64;
-	Version	versions[LevelTable::MAX_LEVEL];	//!< version for each level
-	TimeTable* time_tables[LevelTable::MAX_LEVEL];	//!< TimeTable for each level
+	LevelEntry* levels;	//!< version and TimeTable for each level
+	UInt32 num_levels;	//!< number of entries allocated in levels
+	Time* word_times;	//!< address-major block: num_levels times per word
 	bool compressed; //!< Indicates if this table has compressed TimeTables
 	UInt32 code; // TODO: this should be debug-only or just go away
 
+	LevelTable* gc_prev;	//!< previous table in the garbage collector list
+	LevelTable* gc_next;	//!< next table in the garbage collector list
+	bool in_gc_list;		//!< true if this table is in a LevelTableList
+
+	friend class LevelTableList;
+
+	LevelTable* clock_prev;	//!< previous table in the compression clock ring
+	LevelTable* clock_next;	//!< next table in the compression clock ring
+	bool clock_ref;			//!< referenced since the clock hand last passed
+	bool in_active_set;		//!< true if uncompressed and in the clock ring
+	UInt8 compress_state;	//!< CBuffer::CompressState, accessed atomically
+
+	friend class CBuffer;
+
+	/*!
+	 * @brief Deletes the TimeTable at the given level, returning its
+	 * compressed payload if this table is compressed.
+	 *
+	 * @pre The TimeTable at level is non-NULL.
+	 */
+	void freeTimeTable(Index level);
+
+	/*!
+	 * @brief Grows level storage so it holds at least the given number of
+	 * levels. New levels have version 0 and a NULL TimeTable.
+	 *
+	 * @param new_num_levels The minimum number of levels needed.
+	 */
+	void growLevels(Index new_num_levels);
+
+	/*!
+	 * @brief Allocates a zeroed address-major block with room for the
+	 * given number of levels per word.
+	 */
+	static Time* allocWordTimes(Index depth);
+
+	/*!
+	 * @brief Frees an address-major block allocated with allocWordTimes.
+	 */
+	static void freeWordTimes(Time* block, Index depth);
+
+	/*!
+	 * @brief Zeroes the timestamps of every word at the given level in the
+	 * address-major block.
+	 */
+	void cleanWordTimesAtLevel(Index level);
+
+	/*!
+	 * Returns the index of the word containing addr within this page.
+	 */
+	static unsigned GetWordIndex(Addr addr) {
+		const unsigned WORD_SHIFT = 3;
+		unsigned num_words = TimeTable::GetNumEntries(TimeTable::TYPE_64BIT);
+		return ((UInt64)addr >> WORD_SHIFT) & (num_words - 1);
+	}
+
 public:
 	/*!
-	 * Default, no-argument constructor. Sets all versions to 0 and all
-	 * time_tables to NULL.
+	 * Default, no-argument constructor. No level storage is allocated until
+	 * the first level is written.
 	 */
 	LevelTable();
 
@@ -26,14 +103,34 @@ public:
 	bool isCompressed() { return this->compressed; }
 
 	/*!
-	 * Returns version at specified level.
+	 * Returns true if this table holds any TimeTable or an address-major
+	 * block, i.e. if there is anything for the garbage collector to free.
+	 */
+	bool hasTimes();
+
+	/*!
+	 * Returns the number of levels for which storage is allocated.
+	 */
+	Index getNumLevels() { return num_levels; }
+
+	/*!
+	 * Makes sure storage exists for the given number of levels.
+	 *
+	 * @param depth The number of levels that will be written.
+	 */
+	void reserveLevels(Index depth) {
+		if (depth > num_levels) growLevels(depth);
+	}
+
+	/*!
+	 * Returns version at specified level. Levels without storage have
+	 * version 0.
 	 *
 	 * @param level The level at which to get the version.
-	 * @pre level < MAX_LEVEL
 	 */
 	Version getVersionAtLevel(Index level) {
-		assert(level < LevelTable::MAX_LEVEL);
-		return versions[level];
+		if (level >= num_levels) return 0;
+		return levels[level].version;
 	}
 
 	/*!
@@ -41,11 +138,10 @@ public:
 	 *
 	 * @param level The level at which to get the version.
 	 * @param ver The version we will set it to.
-	 * @pre level < MAX_LEVEL
 	 */
 	void setVersionAtLevel(Index level, Version ver) {
-		assert(level < LevelTable::MAX_LEVEL);
-		versions[level] = ver;
+		reserveLevels(level + 1);
+		levels[level].version = ver;
 	}
 
 	/*!
@@ -53,12 +149,10 @@ public:
 	 * @remark The returned pointer may be NULL.
 	 *
 	 * @param level The level at which to get the TimeTable.
-	 * @pre level < MAX_LEVEL
 	 */
 	TimeTable* getTimeTableAtLevel(Index level) {
-		assert(level < LevelTable::MAX_LEVEL);
-		TimeTable* t = time_tables[level];
-		return t;
+		if (level >= num_levels) return NULL;
+		return levels[level].table;
 	}
 
 	/*!
@@ -66,13 +160,20 @@ public:
 	 *
 	 * @param level The level at which to get the version.
 	 * @param table New value for TimeTable* at level.
-	 * @pre level < MAX_LEVEL
 	 * @pre table is non-NULL
 	 */
 	void setTimeTableAtLevel(Index level, TimeTable *table) {
-		assert(level < LevelTable::MAX_LEVEL);
 		assert(table != NULL);
-		time_tables[level] = table;
+		reserveLevels(level + 1);
+		levels[level].table = table;
+	}
+
+	/*!
+	 * @brief Returns the number of bytes of level storage in a table with
+	 * the given number of levels.
+	 */
+	static UInt64 GetLevelStorageSize(Index num_levels) {
+		return sizeof(LevelEntry) * num_levels;
 	}
 
 	/*!
@@ -84,7 +185,6 @@ public:
 	 * @param level The level at which to get the TimeTable.
 	 * @param addr The address in shadow memory whose timestamp we want.
 	 * @param curr_ver The current version value.
-	 * @pre level < MAX_LEVEL
 	 */
 	Time getTimeForAddrAtLevel(Index level, Addr addr, Version curr_ver);
 
@@ -97,17 +197,90 @@ public:
 	 * @param curr_ver The current version value.
 	 * @param value The new time to set it to.
 	 * @param type The type of access (32 or 64-bit)
-	 * @pre level < MAX_LEVEL
 	 */
 	void setTimeForAddrAtLevel(Index level, Addr addr, 
 								Version curr_ver, Time value, 
 								TimeTable::TableType type);
 
+	/*!
+	 * Reads the timestamps of all levels up to size for the word containing
+	 * addr from the address-major block. Levels whose stored version doesn't
+	 * match the current version read as 0.
+	 *
+	 * @param addr The address in shadow memory whose timestamps we want.
+	 * @param size The number of levels to read.
+	 * @param curr_versions The current version of each level.
+	 * @param[out] times Where to write the timestamps.
+	 * @pre curr_versions and times are non-NULL.
+	 */
+	void getTimesForAddr(Addr addr, Index size, Version *curr_versions, 
+							Time *times);
+
+	/*!
+	 * Writes the timestamps of all levels up to size for the word containing
+	 * addr into the address-major block. Any level whose stored version is
+	 * out of date is cleared for the whole page first.
+	 *
+	 * @param addr The address in shadow memory whose timestamps we set.
+	 * @param size The number of levels to write.
+	 * @param curr_versions The current version of each level.
+	 * @param times The new timestamps.
+	 * @pre curr_versions and times are non-NULL.
+	 */
+	void setTimesForAddr(Addr addr, Index size, Version *curr_versions, 
+							Time *times);
+
+	/*!
+	 * Reads the timestamps of every word in [start, end) at all levels up
+	 * to size, from whichever layout the table uses. Levels whose stored
+	 * version doesn't match the current version read as 0.
+	 *
+	 * @param start The first address to read.
+	 * @param end The address after the last one to read.
+	 * @param size The number of levels to read.
+	 * @param curr_versions The current version of each level.
+	 * @param[out] times Where to write the timestamps, one row of words per
+	 * level.
+	 * @pre start and end are word aligned and within a single page.
+	 * @pre curr_versions and times are non-NULL.
+	 */
+	void getTimesInRange(Addr start, Addr end, Index size, 
+							Version *curr_versions, Time *times);
+
+	/*!
+	 * Writes the timestamps of every word in [start, end) at all levels up
+	 * to size into the level-major TimeTables. Out of date levels are
+	 * cleared for the whole page first.
+	 *
+	 * @param start The first address to write.
+	 * @param end The address after the last one to write.
+	 * @param size The number of levels to write.
+	 * @param curr_versions The current version of each level.
+	 * @param times The new timestamps, one row of words per level.
+	 * @pre start and end are word aligned and within a single page.
+	 * @pre curr_versions and times are non-NULL.
+	 */
+	void setTimesInRange(Addr start, Addr end, Index size, 
+							Version *curr_versions, Time *times);
+
+	/*!
+	 * @brief Zeroes the timestamps of every word in [start, end) at all
+	 * levels. If the range covers the whole page, all TimeTables are freed
+	 * instead.
+	 *
+	 * @param start The first address to clear.
+	 * @param end The address after the last one to clear.
+	 * @pre start and end are word aligned and start < end.
+	 * @pre The range is within a single page.
+	 * @pre This LevelTable is not compressed.
+	 */
+	void clearTimesInRange(Addr start, Addr end);
+
 	/*!
 	 * @brief Returns the shallowest depth at which the level table is invalid.
 	 *
 	 * A given depth is invalid if any of these conditions are met:
-	 * 1. The depth exceeds the MAX_LEVEL for the LevelTable.
+	 * 1. The depth exceeds the number of levels in the LevelTable.
 	 * 2. The timestamp* at that depth is NULL.
 	 * 3. The stored version (versions) at that depth is less than the version at
 	 * that depth in the version array parameter.
@@ -118,7 +291,8 @@ public:
 	unsigned findLowestInvalidIndex(Version *curr_versions);
 
 	/*!
-	 * @brief Removed all TimeTables from the given depth down to MAX_LEVEL.
+	 * @brief Removed all TimeTables from the given depth down to the deepest
+	 * level.
 	 *
 	 * @param start_level The level to start the cleaning.
 	 */
@@ -136,7 +310,8 @@ public:
 	 * @param curr_versions The array of current versions.
 	 * @param end_index The maximum level to garbage collect for.
 	 * @pre curr_versions is non-NULL.
-	 * @pre end_index < MAX_LEVEL
+	 * @remark An address-major block can't be freed one level at a time, so
+	 * it is only freed once level 0 (and therefore every level) is stale.
 	 */
 	void collectGarbageWithinBounds(Version *curr_versions, unsigned end_index);
 
@@ -156,12 +331,15 @@ public:
 	 *
 	 * @remark It is assumed you already garbage collected the table, otherwise
 	 * you are going to be compressing out of data data.
+	 * @param retired_arrays If non-NULL, the uncompressed arrays are added
+	 * here for the caller to free instead of being freed right away (the
+	 * MemPool isn't thread safe).
 	 * @return The number of bytes saved by compression.
 	 * @pre This LevelTable is not compressed.
 	 * @post compressed is 1.
 	 * @invariant code is 0xDEADBEEF
 	 */
-	UInt64 compress();
+	UInt64 compress(std::vector<Time*>* retired_arrays = NULL);
 
 	/*! @brief Decompress the level table.
 	 *
@@ -199,4 +377,64 @@ private:
 	unsigned getDepth();
 };
 
+/*!
+ * @brief An intrusive, doubly linked list of LevelTables.
+ *
+ * The garbage collector keeps the LevelTables that hold timestamps in this
+ * list so it only visits tables that might have something to free. Links
+ * live in the LevelTables themselves, so adding and removing is O(1) and
+ * never allocates. A table can be in at most one list.
+ */
+class LevelTableList {
+private:
+	LevelTable* head;
+	UInt64 size;
+
+public:
+	LevelTableList() : head(NULL), size(0) {}
+
+	LevelTable* getHead() { return head; }
+	UInt64 getSize() { return size; }
+
+	static LevelTable* GetNext(LevelTable* table) { return table->gc_next; }
+	static bool IsListed(LevelTable* table) { return table->in_gc_list; }
+
+	/*!
+	 * Adds a table to the front of the list.
+	 * @pre table is not in a list.
+	 */
+	void push(LevelTable* table) {
+		assert(!table->in_gc_list);
+		table->gc_prev = NULL;
+		table->gc_next = head;
+		if (head != NULL) head->gc_prev = table;
+		head = table;
+		table->in_gc_list = true;
+		++size;
+	}
+
+	/*!
+	 * Removes a table from the list.
+	 * @pre table is in this list.
+	 */
+	void remove(LevelTable* table) {
+		assert(table->in_gc_list);
+		if (table->gc_prev != NULL) table->gc_prev->gc_next = table->gc_next;
+		else head = table->gc_next;
+		if (table->gc_next != NULL) table->gc_next->gc_prev = table->gc_prev;
+		table->gc_prev = table->gc_next = NULL;
+		table->in_gc_list = false;
+		--size;
+	}
+
+	/*!
+	 * Forgets all tables without touching them, e.g. once they have all
+	 * been deleted.
+	 */
+	void clear() {
+		head = NULL;
+		size = 0;
+	}
+};
+
 #endif // _LEVELTABLE_HPP_
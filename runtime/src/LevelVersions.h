@@ -0,0 +1,79 @@
+#ifndef _LEVEL_VERSIONS_H
+#define _LEVEL_VERSIONS_H
+
+#include "ktypes.h"
+
+/*
+ * Shadow memory tags timestamps with the versions (epochs) that
+ * KremlinProfiler::issueVersionToLevel hands out on region entry. Versions
+ * come from a single counter and a level is always entered after its
+ * parent, so along the active region levels passed in as vArray versions
+ * strictly increase with depth. Two consequences let us find the first
+ * stale level without scanning every level:
+ *
+ * - "vArray[i] > lastVer" is false for a prefix of levels and true after it,
+ *   so the boundary can be binary searched.
+ * - If an entry was tagged with lastVer = vArray[lastSize-1], every level at
+ *   or below lastSize was entered after it. As long as level lastSize-1 is
+ *   still in the same epoch (or was only re-entered, e.g. by the next loop
+ *   iteration), the boundary is known directly from lastSize.
+ */
+
+/*!
+ * Returns the first level whose timestamp is stale for an entry last tagged
+ * with version lastVer.
+ *
+ * @param lastVer The version of the deepest level when the entry was tagged.
+ * @param lastSize The number of levels the entry was tagged with, or size
+ * if unknown.
+ * @param vArray The current versions of the active levels.
+ * @param size The number of levels to check.
+ * @pre vArray[0..size) strictly increases.
+ */
+static inline Index getStartInvalidLevel(Version lastVer, Index lastSize, Version* vArray, Index size) {
+	Index bound = (lastSize < size) ? lastSize : size;
+	if (bound == 0)
+		return 0;
+
+	// common cases: the deepest tagged level is still current, or only it
+	// has been re-entered since
+	if (vArray[bound-1] <= lastVer)
+		return bound;
+	if (bound == 1 || vArray[bound-2] <= lastVer)
+		return bound - 1;
+
+	// otherwise the boundary is somewhere in [0, bound-2)
+	Index lo = 0, hi = bound - 2;
+	while (lo < hi) {
+		Index mid = (lo + hi) / 2;
+		if (vArray[mid] <= lastVer) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/*!
+ * Returns the first level at which a per-level version vector no longer
+ * matches the current versions. Versions are unique, so a match at one level
+ * means all shallower levels match as well.
+ *
+ * @param vStored The versions the entry was tagged with.
+ * @param vArray The current versions of the active levels.
+ * @param size The number of levels to check.
+ */
+static inline Index getFirstMismatchLevel(Version* vStored, Version* vArray, Index size) {
+	if (size == 0 || vStored[size-1] == vArray[size-1])
+		return size;
+	if (size == 1 || vStored[size-2] == vArray[size-2])
+		return size - 1;
+
+	Index lo = 0, hi = size - 2;
+	while (lo < hi) {
+		Index mid = (lo + hi) / 2;
+		if (vStored[mid] == vArray[mid]) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+#endif
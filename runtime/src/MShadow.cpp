@@ -0,0 +1,60 @@
+#include <vector>
+
+#include "MShadow.h"
+
+#define MIN(a, b)   (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)   (((a) > (b)) ? (a) : (b))
+
+void MShadow::copy(Addr dest, Addr src, UInt64 size, Index depth, 
+					Version* versions, Time* min_times, Time cost, 
+					Time* max_times) {
+	for (Index i = 0; i < depth; ++i) max_times[i] = 0;
+	if (size == 0 || depth == 0) return;
+
+	std::vector<Time> times(depth);
+	UInt64 grain = granularity;
+	UInt64 grain_mask = grain - 1;
+	UInt64 dest_start = (UInt64)dest;
+	UInt64 dest_end = dest_start + size;
+	UInt64 first_grain = dest_start & ~grain_mask;
+	UInt64 num_grains = ((dest_end + grain_mask) & ~grain_mask) - first_grain;
+	num_grains /= grain;
+
+	// like memmove, go backwards if the destination overlaps the end of
+	// the source
+	bool backward = dest_start > (UInt64)src && dest_start < (UInt64)src + size;
+
+	for (UInt64 n = 0; n < num_grains; ++n) {
+		UInt64 granule = first_grain + grain * (backward ? num_grains - 1 - n : n);
+
+		// the source bytes landing in this granule may span two source
+		// granules
+		UInt64 first = MAX(granule, dest_start) - dest_start + (UInt64)src;
+		UInt64 last = MIN(granule + grain, dest_end) - 1 - dest_start + (UInt64)src;
+
+		Time* src_times = get((Addr)first, depth, versions, 8);
+		for (Index i = 0; i < depth; ++i) times[i] = src_times[i];
+		if ((first & ~grain_mask) != (last & ~grain_mask)) {
+			src_times = get((Addr)last, depth, versions, 8);
+			for (Index i = 0; i < depth; ++i) 
+				times[i] = MAX(times[i], src_times[i]);
+		}
+
+		for (Index i = 0; i < depth; ++i) {
+			times[i] = MAX(times[i], min_times[i]) + cost;
+			max_times[i] = MAX(max_times[i], times[i]);
+		}
+		set((Addr)granule, depth, versions, &times[0], 8);
+	}
+}
+
+void MShadow::fill(Addr dest, UInt64 size, Index depth, Version* versions, 
+					Time* times) {
+	if (size == 0 || depth == 0) return;
+
+	UInt64 first_grain = (UInt64)dest & ~((UInt64)granularity - 1);
+	UInt64 end = (UInt64)dest + size;
+	for (UInt64 granule = first_grain; granule < end; granule += granularity) {
+		set((Addr)granule, depth, versions, times, 8);
+	}
+}
@@ -4,11 +4,70 @@
 #include "ktypes.h"
 
 class MShadow {
+protected:
+	UInt32 granularity; //!< bytes that share one set of timestamps
+
 public:
+	MShadow() : granularity(8) {}
+
 	virtual void init() = 0;
 	virtual void deinit() = 0;
 
+	/*!
+	 * Returns the number of bytes that share timestamps: a store to any of
+	 * them is seen by a load from any other. A power of 2.
+	 */
+	UInt32 getGranularity() { return granularity; }
+
 	virtual Time* get(Addr addr, Index size, Version* versions, UInt32 width) = 0;
 	virtual void set(Addr addr, Index size, Version* versions, Time* times, UInt32 width) = 0;
+
+	/*!
+	 * Resets the timestamps of every granule in [addr, addr+size) at all
+	 * levels, e.g. when the memory is freed. Shadow memories that can't
+	 * drop a range leave the old timestamps in place.
+	 *
+	 * @param addr The start of the range.
+	 * @param size The size of the range in bytes.
+	 * @param versions The current version of each level.
+	 */
+	virtual void clear(Addr addr, UInt64 size, Version* versions) {}
+
+	/*!
+	 * Copies timestamps as a memmove of [src, src+size) to dest would: each
+	 * granule of the destination gets, at every level, the latest timestamp of
+	 * the source bytes it receives raised to at least min_times, plus cost.
+	 * The default goes granule by granule through get and set.
+	 *
+	 * @param dest The start of the destination.
+	 * @param src The start of the source.
+	 * @param size The number of bytes copied.
+	 * @param depth The number of levels to copy.
+	 * @param versions The current version of each level.
+	 * @param min_times The earliest time at each level (e.g. the control
+	 * dependence) before cost is added.
+	 * @param cost The time added to every copied timestamp.
+	 * @param[out] max_times The latest timestamp written at each level.
+	 * @pre versions, min_times and max_times are non-NULL.
+	 */
+	virtual void copy(Addr dest, Addr src, UInt64 size, Index depth, 
+						Version* versions, Time* min_times, Time cost, 
+						Time* max_times);
+
+	/*!
+	 * Sets the timestamps of every granule in [dest, dest+size) at each
+	 * level to the given ones, as a memset would. The default goes granule
+	 * by granule through set.
+	 *
+	 * @param dest The start of the range.
+	 * @param size The size of the range in bytes.
+	 * @param depth The number of levels to set.
+	 * @param versions The current version of each level.
+	 * @param times The timestamp for each level.
+	 * @pre versions and times are non-NULL.
+	 */
+	virtual void fill(Addr dest, UInt64 size, Index depth, Version* versions, 
+						Time* times);
+
 };
 #endif
@@ -9,6 +9,7 @@
 #include "MemMapAllocator.h"
 #include "Table.h"
 #include "compression.h"
+#include "LevelVersions.h"
 
 #include "MShadowStat.h"
 #include "MShadowSkadu.h"
@@ -32,37 +33,12 @@ void SkaduCache::init(int size_in_mb, bool compress, MShadowSkadu *mshadow) {
 
 void SkaduCache::deinit() {
 	if (kremlin_config.getShadowMemCacheSizeInMB() > 0) {
-		// XXX: not sure of logic behind the next two lines (-sat)
-		MemPoolFreeSmall(tag_vector_cache->tagTable, sizeof(TagVectorCacheLine) * tag_vector_cache->getLineCount());
-		delete tag_vector_cache->valueTable;
+		tag_vector_cache->release();
 	}
 	delete tag_vector_cache;
 	tag_vector_cache = NULL;
 }
 
-// XXX: not sure this should be a global function
-int getStartInvalidLevel(Version lastVer, Version* vArray, Index size) {
-	int firstInvalid = 0;
-	if (size == 0)
-		return 0;
-
-	if (size > 2)
-		MSG(SKADU_CACHE_DEBUG_LVL, "\tgetStartInvalidLevel lastVer = %lld, newVer = %lld %lld \n", 
-			lastVer, vArray[size-2], vArray[size-1]);
-
-	if (lastVer == vArray[size-1])
-		return size;
-
-	int i;
-	for (i=size-1; i>=0; i--) {
-		if (lastVer >= vArray[i]) {
-			firstInvalid = i+1;
-			break;
-		}
-	}
-	return firstInvalid;
-
-}
 /*
  * TagVectorCache Evict / Flush / Resize 
  */
@@ -73,45 +49,118 @@ void SkaduCache::evict(int index, Version* vArray) {
 	if (addr == 0x0)
 		return;
 
-	int lastSize = line->lastSize[0];
-	int lastVer = line->version[0];
-	int evictSize = getStartInvalidLevel(lastVer, vArray, lastSize);
-	Time* tArray0 = tag_vector_cache->getData(index, 0);
-	mem_shadow->evict(tArray0, line->tag, evictSize, vArray, line->type);
+	// Clean offsets hold exactly what shadow memory would return for them,
+	// so they can be dropped without a write-back.
+	if (line->isDirty(0)) {
+		int lastSize = line->lastSize[0];
+		Version lastVer = line->version[0];
+		int evictSize = getStartInvalidLevel(lastVer, lastSize, vArray, lastSize);
+		Time* tArray0 = tag_vector_cache->getData(index, 0);
+		mem_shadow->evict(tArray0, line->tag, evictSize, vArray, line->type);
+		eventCacheWriteBack();
+	}
+	else
+		eventCacheCleanDrop();
 
 	if (line->type == TimeTable::TYPE_32BIT) {
-		lastSize = line->lastSize[1];
-		lastVer = line->version[1];
-		evictSize = getStartInvalidLevel(lastVer, vArray, lastSize);
-		Time* tArray1 = tag_vector_cache->getData(index, 1);
-		mem_shadow->evict(tArray1, (char*)line->tag+4, evictSize, vArray, TimeTable::TYPE_32BIT);
+		if (line->isDirty(1)) {
+			int lastSize = line->lastSize[1];
+			Version lastVer = line->version[1];
+			int evictSize = getStartInvalidLevel(lastVer, lastSize, vArray, lastSize);
+			Time* tArray1 = tag_vector_cache->getData(index, 1);
+			mem_shadow->evict(tArray1, (char*)line->tag+4, evictSize, vArray, TimeTable::TYPE_32BIT);
+			eventCacheWriteBack();
+		}
+		else
+			eventCacheCleanDrop();
+	}
+
+	line->clearDirty();
+}
+
+int SkaduCache::makeRoom(Addr addr, Version* vArray) {
+	int index = tag_vector_cache->getFillIndex(addr);
+
+	if (tag_vector_cache->isConflictMiss(addr))
+		eventCacheConflictMiss();
+	else
+		eventCacheCapacityMiss();
+
+	// an empty way displaces nothing, so the victim buffer is left alone
+	if (tag_vector_cache->getTag(index)->tag == 0x0) return index;
+
+	int victim = tag_vector_cache->getVictimSlot();
+	if (victim < 0) {
+		tag_vector_cache->recordEviction(index);
+		evict(index, vArray);
+	} else {
+		// the displaced line waits in the victim buffer; whatever it
+		// replaces there leaves the cache
+		tag_vector_cache->recordEviction(victim);
+		evict(victim, vArray);
+		tag_vector_cache->moveLine(index, victim);
 	}
+	return index;
+}
+
+Time* SkaduCache::reserve(int index, int offset, Index size, Version* vArray) {
+	// free up slab space by writing back and emptying other lines
+	while (!tag_vector_cache->reserveData(index, offset, size)) {
+		// nothing left to reclaim: the slab can't hand out a block this big
+		int reclaim = tag_vector_cache->getReclaimIndex(index);
+		if (reclaim < 0) return NULL;
+
+		eventCacheSlabEvict();
+		dropLine(reclaim, vArray);
+	}
+	return tag_vector_cache->getData(index, offset);
+}
+
+void SkaduCache::dropLine(int index, Version* vArray) {
+	tag_vector_cache->recordEviction(index);
+	evict(index, vArray);
+	tag_vector_cache->clearLine(index);
 }
 
 void SkaduCache::flush(Version* vArray) {
 	int i;
-	int size = tag_vector_cache->getLineCount();
+	int size = tag_vector_cache->getTotalLineCount();
 	for (i=0; i<size; i++) {
 		evict(i, vArray);
 	}
 		
 }
 
-void SkaduCache::resize(int newSize, Version* vArray) {
-	flush(vArray);
-	int size = tag_vector_cache->getSize();
-	int oldDepth = tag_vector_cache->getDepth();
-	int newDepth = oldDepth + 10;
-
-	MSG(SKADU_CACHE_DEBUG_LVL, "TVCacheResize from %d to %d\n", oldDepth, newDepth);
-	MSG(SKADU_CACHE_DEBUG_LVL, "TVCacheResize from %d to %d\n", oldDepth, newDepth);
-	tag_vector_cache->configure(size, newDepth);
+void SkaduCache::resize(int newDepth) {
+	// Lines keep their contents: only the value table is widened.
+	MSG(SKADU_CACHE_DEBUG_LVL, "TVCacheResize from %d to %d\n", 
+		tag_vector_cache->getDepth(), newDepth);
+	tag_vector_cache->setDepth(newDepth);
 }
 
 void SkaduCache::checkResize(int size, Version* vArray) {
 	int oldDepth = tag_vector_cache->getDepth();
 	if (oldDepth < size) {
-		resize(oldDepth + 10, vArray);
+		int newDepth = oldDepth + 10;
+		while (newDepth < size) newDepth += 10;
+		resize(newDepth);
+	}
+}
+
+void SkaduCache::invalidate(Addr addr, UInt64 size) {
+	range_lines.clear();
+	tag_vector_cache->findLinesInRange(addr, (char*)addr + size, &range_lines);
+	for (unsigned i = 0; i < range_lines.size(); ++i) {
+		tag_vector_cache->clearLine(range_lines[i]);
+	}
+}
+
+void SkaduCache::flushRange(Addr addr, UInt64 size, Version* vArray) {
+	range_lines.clear();
+	tag_vector_cache->findLinesInRange(addr, (char*)addr + size, &range_lines);
+	for (unsigned i = 0; i < range_lines.size(); ++i) {
+		evict(range_lines[i], vArray);
+		tag_vector_cache->clearLine(range_lines[i]);
 	}
 }
 
@@ -133,27 +182,43 @@ Time* SkaduCache::get(Addr addr, Index size, Version* vArray, TimeTable::TableTy
 	TagVectorCacheLine* entry = NULL;
 	Time* destAddr = NULL;
 	int offset = 0;
-	int index = 0;
-	tag_vector_cache->lookupRead(addr, type, &index, &entry, &offset, &destAddr);
+	bool victim_hit = false;
+	int index = tag_vector_cache->findLine(addr, &victim_hit);
+	bool hit = (index >= 0);
+
+	// on a miss, make room for the line before we fill it
+	if (!hit) index = makeRoom(addr, vArray);
+
+	tag_vector_cache->lookupRead(addr, type, index, &entry, &offset, &destAddr);
+	destAddr = reserve(index, offset, size, vArray);
+	if (destAddr == NULL) {
+		// the line doesn't fit in the slab, so this access goes straight
+		// to shadow memory
+		eventCacheSlabBypass();
+		dropLine(index, vArray);
+		bypass_times.resize(size);
+		mem_shadow->fetch(addr, size, vArray, &bypass_times[0], type);
+		return &bypass_times[0];
+	}
 	check(addr, destAddr, entry->lastSize[offset], 0);
 
-	if (entry->isHit(addr)) {
+	if (hit) {
 		eventReadHit();
+		if (victim_hit) eventVictimHit();
 		MSG(SKADU_CACHE_DEBUG_LVL, "\t cache hit at 0x%llx size = %d\n", destAddr, size);
 		entry->validateTag(destAddr, vArray, size);
 		check(addr, destAddr, size, 1);
 
 	} else {
 		// Unfortunately, this access results in a miss
-		// 1. evict a line	
+		// 1. evict a line (done by makeRoom)
 		eventReadEvict();
-		evict(index, vArray);
 #if 0
 		Version lastVer = entry->version[offset];
 
 		int lastSize = entry->lastSize[offset];
 		int testSize = (size < lastSize) ? size : lastSize;
-		int evictSize = getStartInvalidLevel(lastVer, vArray, testSize);
+		int evictSize = getStartInvalidLevel(lastVer, lastSize, vArray, testSize);
 
 		MSG(0, "\t CacheGet: evict size = %d, lastSize = %d, size = %d\n", 
 			evictSize, entry->lastSize[offset], size);
@@ -167,6 +232,7 @@ Time* SkaduCache::get(Addr addr, Index size, Version* vArray, TimeTable::TableTy
 
 	entry->setVersion(offset, vArray[size-1]);
 	entry->setValidSize(offset, size);
+	tag_vector_cache->touchLine(index);
 
 	check(addr, destAddr, size, 3);
 	return destAddr;
@@ -176,10 +242,32 @@ void SkaduCache::set(Addr addr, Index size, Version* vArray, Time* tArray, TimeT
 	checkResize(size, vArray);
 	TagVectorCacheLine* entry = NULL;
 	Time* destAddr = NULL;
-	int index = 0;
 	int offset = 0;
+	bool victim_hit = false;
+	int index = tag_vector_cache->findLine(addr, &victim_hit);
+	bool hit = (index >= 0);
+
+	if (!hit) index = makeRoom(addr, vArray);
+
+	// converting to 32-bit copies offset 0 into offset 1
+	TagVectorCacheLine* line = tag_vector_cache->getTag(index);
+	bool fits = true;
+	if (line->type == TimeTable::TYPE_64BIT && type == TimeTable::TYPE_32BIT)
+		fits = (reserve(index, 1, line->lastSize[0], vArray) != NULL);
 
-	tag_vector_cache->lookupWrite(addr, type, &index, &entry, &offset, &destAddr);
+	if (fits) {
+		tag_vector_cache->lookupWrite(addr, type, index, &entry, &offset, &destAddr);
+		destAddr = reserve(index, offset, size, vArray);
+	}
+
+	// the line doesn't fit in the slab, so this access goes straight to
+	// shadow memory
+	if (!fits || destAddr == NULL) {
+		eventCacheSlabBypass();
+		dropLine(index, vArray);
+		mem_shadow->store(addr, size, vArray, tArray, type);
+		return;
+	}
 #if 0
 #ifndef NDEBUG
 	if (hasVersionError(vArray, size)) {
@@ -188,16 +276,16 @@ void SkaduCache::set(Addr addr, Index size, Version* vArray, Time* tArray, TimeT
 #endif
 #endif
 
-	if (entry->isHit(addr)) {
+	if (hit) {
 		eventWriteHit();
+		if (victim_hit) eventVictimHit();
 	} else {
 		eventWriteEvict();
-		evict(index, vArray);
 #if 0
 		Version lastVer = entry->version[offset];
 		int lastSize = entry->lastSize[offset];
 		int testSize = (size < lastSize) ? size : lastSize;
-		int evictSize = getStartInvalidLevel(lastVer, vArray, testSize);
+		int evictSize = getStartInvalidLevel(lastVer, lastSize, vArray, testSize);
 
 		//int evictSize = entry->lastSize[offset];
 		//if (size < evictSize)
@@ -221,6 +309,8 @@ void SkaduCache::set(Addr addr, Index size, Version* vArray, Time* tArray, TimeT
 	entry->tag = addr;
 	entry->setVersion(offset, vArray[size-1]);
 	entry->setValidSize(offset, size);
+	entry->setDirty(offset);
+	tag_vector_cache->touchLine(index);
 
 	check(addr, destAddr, size, 2);
 }
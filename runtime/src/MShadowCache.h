@@ -1,6 +1,7 @@
 #ifndef MSHADOW_SKADUCACHE_H
 #define MSHADOW_SKADUCACHE_H
 
+#include <vector>
 #include "ktypes.h"
 #include "CacheInterface.hpp"
 
@@ -13,13 +14,33 @@ public:
 
 	void  set(Addr addr, Index size, Version* vArray, Time* tArray, TimeTable::TableType type);
 	Time* get(Addr addr, Index size, Version* vArray, TimeTable::TableType type);
+	void invalidate(Addr addr, UInt64 size);
+	void flushRange(Addr addr, UInt64 size, Version* vArray);
 
 private:
 	TagVectorCache *tag_vector_cache;
+	std::vector<int> range_lines; //!< scratch for range operations
+	std::vector<Time> bypass_times; //!< returned by get for lines that don't fit
 
 	void evict(int index, Version* vArray);
+	int  makeRoom(Addr addr, Version* vArray);
+
+	/*!
+	 * Makes room for size levels in one half of a line, writing back and
+	 * emptying other lines as needed.
+	 *
+	 * @return The line's timestamps, or NULL if the slab can't hold them
+	 * even with every other line emptied.
+	 */
+	Time* reserve(int index, int offset, Index size, Version* vArray);
+
+	/*!
+	 * Writes back and empties a line.
+	 */
+	void dropLine(int index, Version* vArray);
+
 	void flush(Version* vArray);
-	void resize(int newSize, Version* vArray);
+	void resize(int newDepth);
 	void checkResize(int size, Version* vArray);
 };
 
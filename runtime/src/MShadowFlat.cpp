@@ -0,0 +1,201 @@
+#include "kremlin.h"
+#include "config.h"
+#include "MShadowFlat.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h> // for sysconf
+
+#include "debug.h"
+
+/*
+ * MemStat: track and print statistics
+ */
+typedef struct _MemStat {
+	UInt64 nWindowReserved;
+	UInt64 nRead;
+	UInt64 nReadStale;
+	UInt64 nWrite;
+} MemStat;
+
+static MemStat stat;
+
+static void printMemStat(UInt64 window_size) {
+	fprintf(stderr, "nWindowReserved = %llu\n", 
+		(unsigned long long)stat.nWindowReserved);
+	fprintf(stderr, "nRead / nReadStale = %llu / %llu\n",
+		(unsigned long long)stat.nRead, (unsigned long long)stat.nReadStale);
+	fprintf(stderr, "nWrite = %llu\n\n", (unsigned long long)stat.nWrite);
+
+	double reserved = stat.nWindowReserved * window_size / (1024.0 * 1024.0);
+	fprintf(stderr, "Reserved shadow = %.2f MB (faulted in on demand)\n",
+		reserved);
+}
+
+/*!
+ * Reserves (but does not commit) size bytes of zero-filled memory.
+ *
+ * @return The range, or NULL if it can't be reserved.
+ */
+static void* reserveRange(UInt64 size) {
+	int protection = PROT_READ | PROT_WRITE;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+	void* data = mmap(NULL, size, protection, flags, -1, 0);
+	return (data == MAP_FAILED) ? NULL : data;
+}
+
+Time* MShadowFlat::reserveWindow(UInt64 index) {
+	assert(index < NUM_WINDOWS);
+	assert(windows[index] == NULL);
+
+	MSG(0, "MShadowFlat: reserving window 0x%llx\n", index);
+	windows[index] = (Time*)reserveRange(window_size);
+	if (windows[index] == NULL) {
+		perror("mmap");
+		fprintf(stderr, "[kremlin] ERROR: out of address space for flat shadow "
+				"memory after %llu windows of %llu GB; profile fewer levels "
+				"or use skadu shadow memory.\n", 
+				(unsigned long long)stat.nWindowReserved,
+				(unsigned long long)(window_size >> 30));
+		exit(1);
+	}
+	stat.nWindowReserved++;
+	return windows[index];
+}
+
+Time* MShadowFlat::get(Addr addr, Index size, Version* vArray, UInt32 width) {
+	MSG(0, "MShadowFlat get 0x%llx, size %u\n", addr, size);
+	if (size < 1) return NULL;
+	assert(size <= depth);
+
+	stat.nRead++;
+
+	Time* slot = getSlot(addr);
+	Version stored_ver = slot[0];
+	Time* times = &slot[1];
+
+	// Versions increase with depth, so everything from the first level
+	// issued a version after the last write is stale.
+	if (vArray[size-1] <= stored_ver)
+		return times;
+
+	Index first_invalid = 0;
+	for (int i = size-1; i >= 0; i--) {
+		if (vArray[i] <= stored_ver) {
+			first_invalid = i+1;
+			break;
+		}
+	}
+
+	// Copy rather than clean in place so loads never dirty shadow pages.
+	stat.nReadStale++;
+	memcpy(read_buffer, times, sizeof(Time) * first_invalid);
+	memset(&read_buffer[first_invalid], 0,
+			sizeof(Time) * (size - first_invalid));
+	return read_buffer;
+}
+
+void MShadowFlat::set(Addr addr, Index size, Version* vArray, Time* tArray, UInt32 width) {
+	MSG(0, "MShadowFlat set 0x%llx, size %u\n", addr, size);
+	if (size < 1) return;
+	assert(size <= depth);
+
+	stat.nWrite++;
+
+	Time* slot = getSlot(addr);
+	slot[0] = vArray[size-1];
+	memcpy(&slot[1], tArray, sizeof(Time) * size);
+}
+
+void MShadowFlat::clear(Addr addr, UInt64 size, Version* vArray) {
+	MSG(0, "MShadowFlat clear 0x%llx, size %llu\n", addr, size);
+	if (size == 0) return;
+
+	// malloc'd blocks and stack frames are 16 byte aligned, so the partial
+	// words at the ends hold nothing but this range
+	UInt64 start = (UInt64)addr & ~((1ULL << WORD_SHIFT) - 1);
+	UInt64 end = (UInt64)addr + size;
+	UInt64 page_size = sysconf(_SC_PAGESIZE);
+
+	UInt64 window_end;
+	for (; start < end; start = window_end) {
+		window_end = (start | WINDOW_OFFSET_MASK) + 1;
+		if (window_end > end) window_end = end;
+
+		// nothing was ever stored in a window that isn't reserved
+		UInt64 index = (start >> WINDOW_SHIFT) & (NUM_WINDOWS - 1);
+		if (windows[index] == NULL) continue;
+
+		// Slots are contiguous within a window. Whole shadow pages are
+		// dropped, which also uncommits them; the rest is zeroed.
+		UInt8* first = (UInt8*)getSlot((Addr)start);
+		UInt8* last = (UInt8*)getSlot((Addr)(window_end - 1)) + slot_size;
+		UInt8* first_page = (UInt8*)(((UInt64)first + page_size - 1) & ~(page_size - 1));
+		UInt8* last_page = (UInt8*)((UInt64)last & ~(page_size - 1));
+		if (first_page < last_page) {
+			memset(first, 0, first_page - first);
+			madvise(first_page, last_page - first_page, MADV_DONTNEED);
+			memset(last_page, 0, last - last_page);
+		}
+		else {
+			memset(first, 0, last - first);
+		}
+	}
+}
+
+UInt64 MShadowFlat::GetWindowSize(Index depth) {
+	// slot = version + depth timestamps
+	UInt64 slots_per_window = (WINDOW_OFFSET_MASK + 1) >> WORD_SHIFT;
+	return slots_per_window * sizeof(Time) * (depth + 1);
+}
+
+bool MShadowFlat::CanReserveWindows() {
+	UInt64 window_size = GetWindowSize(kremlin_config.getNumProfiledLevels());
+	if (window_size > MAX_SHADOW_SIZE / MIN_WINDOWS) return false;
+
+	// all at once, so the address space has to have room for all of them
+	UInt64 size = window_size * MIN_WINDOWS;
+	void* data = reserveRange(size);
+	if (data == NULL) return false;
+
+	munmap(data, size);
+	return true;
+}
+
+void MShadowFlat::init() {
+	fprintf(stderr, "[kremlin] MShadow Flat Init\n");
+
+	depth = kremlin_config.getNumProfiledLevels();
+	slot_size = sizeof(Time) * (depth + 1);
+	window_size = GetWindowSize(depth);
+
+	MSG(0, "MShadowFlat: depth %u, slot %llu bytes, window %llu MB\n",
+		depth, slot_size, window_size >> 20);
+
+	windows = (Time**)reserveRange(sizeof(Time*) * NUM_WINDOWS);
+	if (windows == NULL) {
+		perror("mmap");
+		exit(1);
+	}
+	read_buffer = new Time[depth];
+}
+
+void MShadowFlat::deinit() {
+	printMemStat(window_size);
+
+	for (unsigned i = 0; i < NUM_WINDOWS; ++i) {
+		if (windows[i] != NULL) {
+			munmap(windows[i], window_size);
+			windows[i] = NULL;
+		}
+	}
+	munmap(windows, sizeof(Time*) * NUM_WINDOWS);
+	windows = NULL;
+
+	delete [] read_buffer;
+	read_buffer = NULL;
+}
@@ -0,0 +1,89 @@
+#ifndef _MSHADOW_FLAT_H
+#define _MSHADOW_FLAT_H
+
+#include "ktypes.h"
+#include "MShadow.h"
+
+/*!
+ * @brief Direct-mapped shadow memory.
+ *
+ * Each 4GB window of the address space is shadowed by a single virtual
+ * range reserved with mmap. Within a window, the shadow slot of an 8-byte
+ * word is found with a shift, a multiply and an add; the kernel faults
+ * shadow pages in lazily the first time they are touched. A slot holds the
+ * version of the last write followed by one timestamp per profiled level,
+ * and slots are packed back to back.
+ *
+ * A window takes 2^29 slots of (depth+1) * 8 bytes, about 136GB at the
+ * default depth, so only a few hundred windows fit in the 47-bit user
+ * address space, and fewer the more levels are profiled. The profiler
+ * only picks this shadow memory if MIN_WINDOWS windows fit (see
+ * CanReserveWindows); a program that touches more windows than the
+ * address space can hold stops with an error.
+ *
+ * clear() zeroes the slots of the range (handing whole shadow pages back
+ * to the kernel); copy() and fill() use the granule by granule defaults of
+ * MShadow.
+ */
+class MShadowFlat : public MShadow {
+private:
+	static const unsigned WORD_SHIFT = 3; // 8-byte granularity
+	static const unsigned WINDOW_SHIFT = 32; // each window covers 4GB
+	static const unsigned NUM_WINDOWS = 1 << 16; // covers 48-bit addresses
+	static const UInt64 WINDOW_OFFSET_MASK = 0xffffffffULL;
+	static const UInt64 MAX_SHADOW_SIZE = 1ULL << 47; // user address space
+	static const unsigned MIN_WINDOWS = 16; // enough for most programs
+
+	Time** windows; //!< Base of shadow for each window (NULL if unused)
+	Index depth; //!< Number of timestamps per slot
+	UInt64 slot_size; //!< Number of bytes per slot
+	UInt64 window_size; //!< Number of bytes reserved per window
+
+	Time* read_buffer; //!< Returned by get when a slot has stale levels
+
+	/*!
+	 * Reserves the shadow range for the window with the given index.
+	 *
+	 * @param index The upper bits of the addresses in the window.
+	 * @return Base address of the reserved shadow range.
+	 * @post windows[index] is non-NULL.
+	 */
+	Time* reserveWindow(UInt64 index);
+
+	/*!
+	 * Returns the slot associated with an address. The first element of the
+	 * slot is the stored version; timestamps follow it.
+	 */
+	Time* getSlot(Addr addr) {
+		UInt64 index = ((UInt64)addr >> WINDOW_SHIFT) & (NUM_WINDOWS - 1);
+		Time* base = windows[index];
+		if (base == NULL) base = reserveWindow(index);
+
+		UInt64 offset = ((UInt64)addr & WINDOW_OFFSET_MASK) >> WORD_SHIFT;
+		return (Time*)((UInt8*)base + offset * slot_size);
+	}
+
+	/*!
+	 * Returns the number of bytes reserved per window for the given number
+	 * of timestamps per slot.
+	 */
+	static UInt64 GetWindowSize(Index depth);
+
+public:
+	/*!
+	 * Returns true if MIN_WINDOWS windows of shadow can be reserved with
+	 * the configured number of profiled levels. They can't if there are
+	 * too many levels, the kernel doesn't overcommit
+	 * (vm.overcommit_memory=2) or the address space is limited.
+	 */
+	static bool CanReserveWindows();
+
+	void init();
+	void deinit();
+
+	Time* get(Addr addr, Index size, Version* versions, UInt32 width);
+	void set(Addr addr, Index size, Version* versions, Time* times, UInt32 width);
+	void clear(Addr addr, UInt64 size, Version* versions);
+};
+
+#endif
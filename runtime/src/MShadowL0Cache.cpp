@@ -0,0 +1,172 @@
+#include <cassert>
+#include <string.h> // for memcpy
+
+#include "debug.h"
+#include "LevelVersions.h"
+#include "MShadowStat.h"
+#include "MShadowL0Cache.h"
+
+L0Cache::L0Cache(CacheInterface* next, int num_entries) :
+	next(next), num_entries(num_entries), use_clock(0), depth(0) {
+	assert(next != NULL);
+	assert(num_entries > 0 && num_entries <= MAX_ENTRIES);
+	memset(entries, 0, sizeof(entries));
+}
+
+L0Cache::~L0Cache() {
+	delete next;
+}
+
+void L0Cache::init(int size, bool compress, MShadowSkadu* mshadow) {
+	this->use_compression = compress;
+	this->mem_shadow = mshadow;
+	next->init(size, compress, mshadow);
+	MSG(0, "L0Cache: %d entries\n", num_entries);
+}
+
+void L0Cache::deinit() {
+	memset(entries, 0, sizeof(entries));
+	std::vector<Time>().swap(times);
+	depth = 0;
+	next->deinit();
+	this->mem_shadow = NULL;
+}
+
+int L0Cache::findEntry(Addr addr) {
+	for (int i = 0; i < num_entries; ++i) {
+		if (entries[i].tag != NULL
+			&& (((UInt64)entries[i].tag ^ (UInt64)addr) >> 3) == 0)
+			return i;
+	}
+	return -1;
+}
+
+int L0Cache::makeRoom(Version* vArray) {
+	int victim = -1;
+	for (int i = 0; i < num_entries; ++i) {
+		if (entries[i].tag == NULL) return i;
+		if (victim < 0 || entries[i].last_use < entries[victim].last_use)
+			victim = i;
+	}
+
+	writeBack(victim, vArray);
+	entries[victim].tag = NULL;
+	return victim;
+}
+
+void L0Cache::writeBack(int index, Version* vArray) {
+	Entry* entry = &entries[index];
+	if (!entry->dirty) return;
+
+	// levels whose region was re-entered since the last access are stale
+	// and need not be written
+	Index size = getStartInvalidLevel(entry->version, entry->last_size,
+										vArray, entry->last_size);
+	if (size > 0)
+		next->set(entry->tag, size, vArray, getTimes(index), TimeTable::TYPE_64BIT);
+	entry->dirty = false;
+	eventL0WriteBack();
+}
+
+void L0Cache::checkResize(Index size) {
+	if (size <= depth) return;
+
+	Index new_depth = depth + 10;
+	while (new_depth < size) new_depth += 10;
+
+	std::vector<Time> new_times(num_entries * new_depth, 0);
+	if (depth > 0) {
+		for (int i = 0; i < num_entries; ++i) {
+			memcpy(&new_times[i * new_depth], getTimes(i), sizeof(Time) * depth);
+		}
+	}
+	times.swap(new_times);
+	depth = new_depth;
+}
+
+Time* L0Cache::get(Addr addr, Index size, Version* vArray, TimeTable::TableType type) {
+	int index = findEntry(addr);
+	if (type != TimeTable::TYPE_64BIT) {
+		if (index >= 0) {
+			writeBack(index, vArray);
+			entries[index].tag = NULL;
+		}
+		return next->get(addr, size, vArray, type);
+	}
+
+	checkResize(size);
+
+	Time* dest = NULL;
+	if (index >= 0) {
+		eventL0ReadHit();
+		dest = getTimes(index);
+		Entry* entry = &entries[index];
+		Index first_invalid = getStartInvalidLevel(entry->version,
+											entry->last_size, vArray, size);
+		if (size > first_invalid)
+			memset(&dest[first_invalid], 0, sizeof(Time) * (size - first_invalid));
+	} else {
+		eventL0ReadMiss();
+		index = makeRoom(vArray);
+		dest = getTimes(index);
+		memcpy(dest, next->get(addr, size, vArray, type), sizeof(Time) * size);
+		entries[index].tag = addr;
+		entries[index].dirty = false;
+	}
+
+	Entry* entry = &entries[index];
+	entry->version = vArray[size-1];
+	entry->last_size = size;
+	entry->last_use = ++use_clock;
+	return dest;
+}
+
+void L0Cache::set(Addr addr, Index size, Version* vArray, Time* tArray, TimeTable::TableType type) {
+	int index = findEntry(addr);
+	if (type != TimeTable::TYPE_64BIT) {
+		if (index >= 0) {
+			writeBack(index, vArray);
+			entries[index].tag = NULL;
+		}
+		next->set(addr, size, vArray, tArray, type);
+		return;
+	}
+
+	checkResize(size);
+
+	// all size levels are overwritten, so a miss doesn't fetch anything
+	if (index >= 0) {
+		eventL0WriteHit();
+	} else {
+		eventL0WriteMiss();
+		index = makeRoom(vArray);
+		entries[index].tag = addr;
+	}
+
+	Entry* entry = &entries[index];
+	memcpy(getTimes(index), tArray, sizeof(Time) * size);
+	entry->version = vArray[size-1];
+	entry->last_size = size;
+	entry->dirty = true;
+	entry->last_use = ++use_clock;
+}
+
+void L0Cache::invalidate(Addr addr, UInt64 size) {
+	for (int i = 0; i < num_entries; ++i) {
+		Addr tag = entries[i].tag;
+		if (tag != NULL && tag >= addr && tag < (char*)addr + size)
+			entries[i].tag = NULL;
+	}
+	next->invalidate(addr, size);
+}
+
+void L0Cache::flushRange(Addr addr, UInt64 size, Version* vArray) {
+	for (int i = 0; i < num_entries; ++i) {
+		Addr tag = entries[i].tag;
+		if (tag != NULL && tag >= addr && tag < (char*)addr + size) {
+			writeBack(i, vArray);
+			entries[i].tag = NULL;
+		}
+	}
+	next->flushRange(addr, size, vArray);
+}
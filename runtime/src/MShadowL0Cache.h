@@ -0,0 +1,93 @@
+#ifndef MSHADOW_L0CACHE_H
+#define MSHADOW_L0CACHE_H
+
+#include <vector>
+#include "ktypes.h"
+#include "CacheInterface.hpp"
+
+/*!
+ * @brief A few fully associative entries in front of another shadow cache.
+ *
+ * Back-to-back accesses often go to the same few words (an accumulator
+ * that is read and written again, neighbouring array elements that share a
+ * granule). Each entry keeps the timestamps of one word in a small array
+ * that stays in the L1, so those accesses skip the lookup and bookkeeping
+ * of the next cache entirely. Entries are validated against the current
+ * versions the same way TagVectorCacheLines are, and dirty entries are
+ * written to the next cache only when they are replaced or their range is
+ * flushed.
+ *
+ * Only 64 bit entries are kept; other accesses go straight to the next
+ * cache.
+ */
+class L0Cache : public CacheInterface {
+public:
+	static const int MAX_ENTRIES = 8;
+
+	/*!
+	 * @param next The cache behind this one. It is deleted with this cache.
+	 * @param num_entries Number of entries, at most MAX_ENTRIES.
+	 */
+	L0Cache(CacheInterface* next, int num_entries);
+	~L0Cache();
+
+	/*!
+	 * Initializes the cache behind this one with the same arguments.
+	 */
+	void init(int size, bool compress, MShadowSkadu* mshadow);
+
+	/*!
+	 * Drops all entries, without writing them back, and deinitializes the
+	 * cache behind this one.
+	 */
+	void deinit();
+
+	void  set(Addr addr, Index size, Version* vArray, Time* tArray, TimeTable::TableType type);
+	Time* get(Addr addr, Index size, Version* vArray, TimeTable::TableType type);
+	void invalidate(Addr addr, UInt64 size);
+	void flushRange(Addr addr, UInt64 size, Version* vArray);
+
+private:
+	class Entry {
+	public:
+		Addr tag;			//!< NULL if the entry is empty
+		Version version;	//!< version of the deepest level at the last access
+		Index last_size;	//!< number of levels at the last access
+		bool dirty;			//!< set when written, cleared on write-back
+		UInt64 last_use;	//!< for LRU replacement
+	};
+
+	CacheInterface* next;
+	int num_entries;
+	Entry entries[MAX_ENTRIES];
+	UInt64 use_clock;
+
+	Index depth;				//!< levels each entry has room for
+	std::vector<Time> times;	//!< depth levels per entry, entry by entry
+
+	Time* getTimes(int index) { return &times[index * depth]; }
+
+	/*!
+	 * Returns the index of the entry holding addr, or -1 if there is none.
+	 */
+	int findEntry(Addr addr);
+
+	/*!
+	 * Writes back and empties the least recently used entry (unless it is
+	 * already empty) and returns its index.
+	 */
+	int makeRoom(Version* vArray);
+
+	/*!
+	 * Writes the valid levels of an entry to the next cache if the entry is
+	 * dirty. The entry keeps its contents but is clean afterwards.
+	 */
+	void writeBack(int index, Version* vArray);
+
+	/*!
+	 * Makes sure every entry has room for size levels.
+	 */
+	void checkResize(Index size);
+};
+
+#endif
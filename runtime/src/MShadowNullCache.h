@@ -18,6 +18,8 @@ public:
 
 	void  set(Addr addr, Index size, Version* vArray, Time* tArray, TimeTable::TableType type);
 	Time* get(Addr addr, Index size, Version* vArray, TimeTable::TableType type);
+	void invalidate(Addr addr, UInt64 size) {}
+	void flushRange(Addr addr, UInt64 size, Version* vArray) {}
 };
 
 #endif
@@ -1,6 +1,8 @@
 #include "kremlin.h"
 #include "config.h"
+#include "SparseTable.hpp"
 #include "MShadowSTV.h"
+#include "LevelVersions.h"
 
 #include <assert.h>
 #include <limits.h>
@@ -206,16 +208,7 @@ static SegEntry* SegTableGetEntry(SegTable* segTable, Addr addr) {
 }
 
 static void TagValidate(Time* tAddr, Version* vAddr, Version* vArray, int size) {
-	int i;
-	int startInvalid = 0;
-	Version oldVersion = *vAddr;
-
-	for (i=size-1; i>=0; i--) {
-		if (vArray[i] <= oldVersion) {
-			startInvalid = i+1;
-			break;
-		}
-	}
+	int startInvalid = getStartInvalidLevel(*vAddr, size, vArray, size);
 
 	if (startInvalid < size) {
 		bzero(tAddr + startInvalid, sizeof(Time) * (size - startInvalid));
@@ -321,64 +314,39 @@ static Time* SegTableGetTime(SegEntry* entry, Addr addr, Index size, Version* vA
 
 /*
  * STable: sparse table that tracks 4GB memory chunks being used
- *
- * Since 64bit address is very sparsely used in a program,
- * we use a sparse table to reduce the memory requirement of the table.
- * Although the walk-through of a table might be pricey,
- * the use of cache will make the frequency of walk-through very low.
+ * (see SparseTable.hpp)
  */
 
-typedef struct _SEntry {
-	UInt32 	addrHigh;	// upper 32bit in 64bit addr
-	SegTable* segTable;
-} SEntry;
-
-#define STABLE_SIZE		32		// 128GB addr space will be enough
-
-typedef struct _STable {
-	SEntry entry[STABLE_SIZE];	
-	int writePtr;
-} STable;
-
-
-static STable sTable;
+static SparseTable<SegTable> sTable;
 
 static void STableInit() {
-	sTable.writePtr = 0;
+	sTable.init();
 }
 
 static void STableDeinit() {
-	int i;
+	unsigned i;
 
-	for (i=0; i<sTable.writePtr; i++) {
-		SegTableFree(sTable.entry[i].segTable);		
+	for (i=0; i<sTable.getNumElements(); i++) {
+		SegTableFree(sTable.getElementAtIndex(i)->segTable);		
 	}
+	sTable.deinit();
 }
 
 static SegTable* STableGetSegTable(Addr addr) {
-	UInt32 highAddr = (UInt32)((UInt64)addr >> 32);
-
-	// walk-through STable
-	int i;
-	for (i=0; i<sTable.writePtr; i++) {
-		if (sTable.entry[i].addrHigh == highAddr) {
-			//MSG(1, "STable Found an existing entry..\n");
-			return sTable.entry[i].segTable;	
-		}
-	}
+	SparseTable<SegTable>::Element* e = sTable.getElement(addr);
+	if (e->segTable != NULL)
+		return e->segTable;
 
 	// not found - create an entry
 	MSG(DEBUGLEVEL, "STable Creating a new Entry..\n");
 	stat.nSTableEntry++;
 
-	SegTable* ret = SegTableAlloc();
-	sTable.entry[sTable.writePtr].addrHigh = highAddr;
-	sTable.entry[sTable.writePtr].segTable = ret;
-	sTable.writePtr++;
-	return ret;
+	e->segTable = SegTableAlloc();
+	return e->segTable;
 }
 
 
+
 Time* MShadowSTV::get(Addr addr, Index size, Version* vArray, UInt32 width) {
 	MSG(DEBUGLEVEL, "MShadowGet 0x%llx, size %d\n", addr, size);
 
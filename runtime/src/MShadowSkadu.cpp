@@ -1,5 +1,8 @@
 #include <cassert>
+#include <limits.h> // for UINT_MAX
+#include <stdio.h>
 #include <string.h> // for memset
+#include <sys/time.h> // for gettimeofday
 #include <vector>
 
 #include "config.h"
@@ -9,103 +12,177 @@
 #include "LevelTable.hpp"
 #include "MemorySegment.hpp"
 #include "MShadowSkadu.h"
+#include "SparseTable.hpp"
+#include "StaticShadow.hpp"
 #include "MShadowStat.h" // for event counters
 #include "compression.h" // for CBuffer
 
 #include "MShadowCache.h"
 #include "MShadowNullCache.h"
+#include "MShadowL0Cache.h"
 
-/*!
- * @brief A sparse table that tracks 4GB memory chunks being used.
- *
- * Since 64bit address is very sparsely used in a program,
- * we use a sparse table to reduce the memory requirement of the table.
- * Although the walk-through of a table might be pricey,
- * the use of cache will make the frequency of walk-through very low.
- */
-class SparseTableElement {
-public:
-	UInt32 	addrHigh;	// upper 32bit in 64bit addr
-	MemorySegment* segTable;
-};
-
-/*!
- * @brief A class to efficiently support 64-bit address space
- */
-class SparseTable {
-public:
-	static const unsigned int NUM_ENTRIES = 32;
+#define MIN(a, b)   (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)   (((a) > (b)) ? (a) : (b))
 
-	std::vector<SparseTableElement> entry;
-	int writePtr;
+void MShadowSkadu::initGarbageCollector(unsigned period) {
+	MSG(3, "set garbage collection period to %u\n", period);
+	next_gc_time = period;
+	garbage_collection_period = period;
+	if (period == 0) next_gc_time = 0xFFFFFFFFFFFFFFFF;
+	gc_list = new LevelTableList();
+	gc_cursor = NULL;
+}
+
+#ifdef KREMLIN_DEBUG
+static UInt64 getTimeInUsec() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (UInt64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+#endif
 
-	void init() { 
-		entry.resize(SparseTable::NUM_ENTRIES);
-		writePtr = 0;
+void MShadowSkadu::runGarbageCollectorStep(Version* curr_versions, int size) {
+	assert(gc_cursor != NULL);
+
+	// step timing and reclaimed bytes are only reported in debug builds
+#ifdef KREMLIN_DEBUG
+	UInt64 start_time = getTimeInUsec();
+	UInt64 start_mem = getTimeTableMemSize();
+#endif
+
+	for (unsigned i = 0; i < GC_TABLES_PER_STEP && gc_cursor != NULL; ++i) {
+		LevelTable* lTable = gc_cursor;
+		gc_cursor = LevelTableList::GetNext(lTable);
+
+		// leave tables alone while the compression thread has them
+		if (useCompression() && compression_buffer->isPending(lTable))
+			continue;
+
+		lTable->collectGarbageWithinBounds(curr_versions, size);
+		if (!lTable->hasTimes())
+			gc_list->remove(lTable);
 	}
 
-	void deinit() {
-		for (int i = 0; i < writePtr; i++) {
-			SparseTableElement* e = &entry[i];
-			delete e->segTable;		
-			e->segTable = NULL;
-			eventSegTableFree();
+#ifdef KREMLIN_DEBUG
+	UInt64 end_mem = getTimeTableMemSize();
+	UInt64 reclaimed = (start_mem > end_mem) ? start_mem - end_mem : 0;
+	eventGCStep(getTimeInUsec() - start_time, reclaimed);
+#endif
+}
+
+UInt64 MShadowSkadu::getMemUsage() {
+	UInt64 usage = getChunkResidentBytes() + MemPoolGetSmallPoolBytes()
+		+ ((UInt64)kremlin_config.getShadowMemCacheSizeInMB() << 20)
+		+ static_shadow->getBytesReserved();
+	if (useCompression())
+		usage += compression_buffer->getPayloadBytesInMemory();
+	return usage;
+}
+
+void MShadowSkadu::startCompression() {
+	assert(compression_reserved && !compression_enabled);
+	compression_enabled = true;
+	compression_buffer->enable(compression_buffer_size);
+
+	for (unsigned i = 0; i < sparse_table->getNumElements(); ++i) {
+		MemorySegment* segTable = sparse_table->getElementAtIndex(i)->segTable;
+		if (segTable == NULL) continue;
+
+		for (unsigned j = 0; j < MemorySegment::getNumLevelTables(); ++j) {
+			LevelTable* lTable = segTable->getLevelTableAtIndex(j);
+			if (lTable != NULL) compression_buffer->add(lTable);
 		}
 	}
+}
 
-	SparseTableElement* getElement(Addr addr) {
-		UInt32 highAddr = (UInt32)((UInt64)addr >> 32);
+void MShadowSkadu::enforceMemLimit(Version* curr_versions, int size) {
+	UInt64 soft_limit = mem_limit / 100 * BUDGET_SOFT_PERCENT;
+	UInt64 usage = getMemUsage();
+	eventMemUsage(usage);
+	if (usage < soft_limit) {
+		budget_stalled_usage = 0;
+
+		// Well under the limit again, compressed tables may come back as
+		// they are accessed. Waiting for a lower mark keeps this from
+		// undoing the last shrink right away.
+		if (usage < mem_limit / 100 * BUDGET_RESTORE_PERCENT
+			&& useCompression()
+			&& compression_buffer->getSize() < compression_buffer_size)
+			compression_buffer->grow(compression_buffer_size);
+		return;
+	}
 
-		// walk-through SparseTable
-		for (int i=0; i < writePtr; i++) {
-			if (entry[i].addrHigh == highAddr) {
-				//MSG(0, "SparseTable Found an existing entry..\n");
-				return &entry[i];	
-			}
-		}
+	// a pass that reclaimed nothing won't do better until the program has
+	// allocated a good deal more
+	if (budget_stalled_usage > 0 && usage < budget_stalled_usage 
+							+ mem_limit / 100 * BUDGET_RETRY_PERCENT)
+		return;
 
-		// not found - create an entry
-		MSG(0, "SparseTable Creating a new Entry..\n");
+	UInt64 start_usage = usage;
 
-		SparseTableElement* ret = &entry[writePtr];
-		ret->addrHigh = highAddr;
-		ret->segTable = new MemorySegment();
-		eventSegTableAlloc();
-		writePtr++;
-		return ret;
+	// 1. drop stale timestamps now rather than at the next GC period, and
+	// give what that frees back to the OS
+	eventMemLimitGC();
+	if (gc_cursor == NULL) {
+		eventGC();
+		gc_cursor = gc_list->getHead();
+	}
+	while (gc_cursor != NULL)
+		runGarbageCollectorStep(curr_versions, size);
+	MemPoolReleaseFree();
+	usage = getMemUsage();
+
+	// 2. compress the colder half of the uncompressed tables (payloads go
+	// to the spill arena if there is one)
+	if (usage >= soft_limit && compression_reserved && !compression_enabled)
+		startCompression();
+
+	if (usage >= soft_limit && useCompression()
+		&& compression_buffer->getActiveSize() > MIN_UNCOMPRESSED_TABLES) {
+		eventMemLimitCompress();
+		unsigned keep = compression_buffer->getActiveSize() / 2;
+		if (keep < MIN_UNCOMPRESSED_TABLES) keep = MIN_UNCOMPRESSED_TABLES;
+		eventCompression(compression_buffer->shrink(keep));
+		MemPoolReleaseFree();
+		usage = getMemUsage();
 	}
-	
-};
 
-void MShadowSkadu::initGarbageCollector(unsigned period) {
-	MSG(3, "set garbage collection period to %u\n", period);
-	next_gc_time = period;
-	garbage_collection_period = period;
-	if (period == 0) next_gc_time = 0xFFFFFFFFFFFFFFFF;
+	budget_stalled_usage = (usage >= start_usage) ? usage : 0;
+
+	if (usage > mem_limit && !budget_warned) {
+		fprintf(stderr, "[kremlin] WARNING: shadow memory uses %llu MB, over "
+				"the %llu MB limit, and nothing more can be reclaimed.\n",
+				(unsigned long long)(usage >> 20), 
+				(unsigned long long)(mem_limit >> 20));
+		budget_warned = true;
+	}
 }
 
-void MShadowSkadu::runGarbageCollector(Version* curr_versions, int size) {
-	eventGC();
-	for (unsigned i = 0; i < SparseTable::NUM_ENTRIES; ++i) {
-		MemorySegment* table = sparse_table->entry[i].segTable;	
-		if (table == NULL)
-			continue;
-		
-		for (unsigned j = 0; j < MemorySegment::getNumLevelTables(); ++j) {
-			LevelTable* lTable = table->getLevelTableAtIndex(j);
-			if (lTable != NULL) {
-				lTable->collectGarbageWithinBounds(curr_versions, size);
-			}
-		}
+MemorySegment* MShadowSkadu::getMemorySegment(Addr addr) {
+	SparseTable<MemorySegment>::Element* sEntry = sparse_table->getElement(addr);
+	MemorySegment* segTable = sEntry->segTable;
+	if (segTable == NULL) {
+		MSG(0, "SparseTable Creating a new Entry..\n");
+		segTable = sEntry->segTable = new MemorySegment();
+		eventSegTableAlloc();
 	}
+	return segTable;
+}
+
+bool MShadowSkadu::isPageWritten(Addr addr) {
+	SparseTable<MemorySegment>::Element* sEntry = sparse_table->findElement(addr);
+	if (sEntry == NULL || sEntry->segTable == NULL) return false;
+	return sEntry->segTable->isPageWritten(MemorySegment::GetIndex(addr));
+}
+
+void MShadowSkadu::markPageWritten(Addr addr) {
+	getMemorySegment(addr)->setPageWritten(MemorySegment::GetIndex(addr));
 }
 
 LevelTable* MShadowSkadu::getLevelTable(Addr addr, Version *curr_versions) {
 	assert(curr_versions != NULL);
 
-	SparseTableElement* sEntry = sparse_table->getElement(addr);
-	MemorySegment* segTable = sEntry->segTable;
-	assert(segTable != NULL);
+	MemorySegment* segTable = getMemorySegment(addr);
 	unsigned segIndex = MemorySegment::GetIndex(addr);
 	LevelTable* lTable = segTable->getLevelTableAtIndex(segIndex);
 	if (lTable == NULL) {
@@ -118,16 +195,241 @@ LevelTable* MShadowSkadu::getLevelTable(Addr addr, Version *curr_versions) {
 		eventLevelTableAlloc();
 	}
 	
-	if(useCompression() && lTable->isCompressed()) {
+	prepareLevelTable(lTable, curr_versions);
+	return lTable;
+}
+
+void MShadowSkadu::prepareLevelTable(LevelTable *lTable, Version *curr_versions) {
+	assert(lTable != NULL);
+	assert(curr_versions != NULL);
+
+	if (useCompression() && compression_buffer->claim(lTable)) {
+		// taken off the compression queue before it was compressed
+		int gain = compression_buffer->add(lTable);
+		eventCompression(gain);
+	}
+	else if(useCompression() && lTable->isCompressed()) {
 		lTable->collectGarbageUnbounded(curr_versions);
 		int gain = compression_buffer->decompress(lTable);
 		eventCompression(gain);
 	}
+}
 
+LevelTable* MShadowSkadu::findLevelTable(Addr addr, Version *curr_versions) {
+	SparseTable<MemorySegment>::Element* sEntry = sparse_table->findElement(addr);
+	if (sEntry == NULL || sEntry->segTable == NULL) return NULL;
 
+	unsigned segIndex = MemorySegment::GetIndex(addr);
+	LevelTable* lTable = sEntry->segTable->getLevelTableAtIndex(segIndex);
+	if (lTable != NULL) prepareLevelTable(lTable, curr_versions);
 	return lTable;
 }
 
+void MShadowSkadu::clear(Addr addr, UInt64 size, Version *curr_versions) {
+	assert(curr_versions != NULL);
+	if (size == 0) return;
+
+	static_shadow->clear(addr, size);
+
+	// malloc'd blocks and stack frames are 16 byte aligned, so the partial
+	// granules at the ends hold nothing but this range. Bigger granules may
+	// be shared with neighbouring data, so only whole ones are dropped.
+	UInt64 first = getGranule(addr);
+	UInt64 last = getGranule((char*)addr + size - 1) + 1;
+	if (granularity > 16) {
+		if (((UInt64)addr & (granularity - 1)) != 0) ++first;
+		if ((((UInt64)addr + size) & (granularity - 1)) != 0) --last;
+		if (first >= last) return;
+	}
+
+	UInt64 start = first << 3;
+	UInt64 end = last << 3;
+	MSG(0, "mshadow clear 0x%llx - 0x%llx\n", start, end);
+
+	// cached timestamps are dropped without being written back
+	cache->invalidate((Addr)start, end - start);
+
+	UInt64 page_size = MemorySegment::GetPageSize();
+	UInt64 page_end;
+	for (UInt64 page = start; page < end; page = page_end) {
+		page_end = (page & ~(page_size - 1)) + page_size;
+		if (page_end > end) page_end = end;
+
+		LevelTable* lTable = findLevelTable((Addr)page, curr_versions);
+		if (lTable != NULL)
+			lTable->clearTimesInRange((Addr)page, (Addr)page_end);
+
+		// loads from a page that is now empty can skip the cache again
+		if (page_end - page == page_size) {
+			SparseTable<MemorySegment>::Element* sEntry = 
+				sparse_table->findElement((Addr)page);
+			if (sEntry != NULL && sEntry->segTable != NULL)
+				sEntry->segTable->clearPageWritten(MemorySegment::GetIndex((Addr)page));
+		}
+	}
+	eventShadowClear((last - first) << granularity_shift);
+}
+
+/*
+ * Returns how many bytes from offset on (or, going backwards, before
+ * offset) stay within the current page of both start addresses.
+ */
+static UInt64 getPieceSize(UInt64 dest, UInt64 src, UInt64 offset, 
+							UInt64 len, bool backward) {
+	UInt64 page_size = MemorySegment::GetPageSize();
+	if (backward) {
+		UInt64 dest_in = ((dest + offset - 1) & (page_size - 1)) + 1;
+		UInt64 src_in = ((src + offset - 1) & (page_size - 1)) + 1;
+		return MIN(offset, MIN(dest_in, src_in));
+	}
+	UInt64 dest_left = page_size - ((dest + offset) & (page_size - 1));
+	UInt64 src_left = page_size - ((src + offset) & (page_size - 1));
+	return MIN(len - offset, MIN(dest_left, src_left));
+}
+
+void MShadowSkadu::storeRange(Addr start, Addr end, Index size, 
+								Version *curr_versions, Time *times) {
+	markPageWritten(start);
+	LevelTable* lTable = this->getLevelTable(start, curr_versions);
+	if (address_major) {
+		// gather each word's levels into one contiguous column
+		unsigned num_words = ((UInt64)end - (UInt64)start) >> 3;
+		Time* column = &range_times[size * num_words];
+		for (unsigned w = 0; w < num_words; ++w) {
+			for (Index i = 0; i < size; ++i) 
+				column[i] = times[i * num_words + w];
+			lTable->setTimesForAddr((char*)start + 8 * w, size, 
+									curr_versions, column);
+		}
+	}
+	else {
+		lTable->setTimesInRange(start, end, size, curr_versions, times);
+	}
+
+	if (!LevelTableList::IsListed(lTable))
+		gc_list->push(lTable);
+
+	if (useCompression())
+		compression_buffer->touch(lTable);
+}
+
+void MShadowSkadu::copy(Addr dest, Addr src, UInt64 size, Index depth, 
+						Version *curr_versions, Time *min_times, Time cost, 
+						Time *max_times) {
+	// Granules only line up with granules if both ends are equally aligned,
+	// and only LevelTables can be copied directly.
+	if ((((UInt64)dest - (UInt64)src) & (granularity - 1)) != 0
+		|| static_shadow->overlaps(dest, size) 
+		|| static_shadow->overlaps(src, size)) {
+		MShadow::copy(dest, src, size, depth, curr_versions, min_times, 
+						cost, max_times);
+		return;
+	}
+
+	for (Index i = 0; i < depth; ++i) max_times[i] = 0;
+	if (size == 0 || depth == 0) return;
+
+	UInt64 num_grains = getGranule((char*)dest + size - 1) - getGranule(dest) + 1;
+	UInt64 dest_start = (UInt64)getShadowAddr(dest);
+	UInt64 src_start = (UInt64)getShadowAddr(src);
+	UInt64 len = num_grains << 3;
+	MSG(0, "mshadow copy 0x%llx <- 0x%llx, %llu bytes\n", 
+		dest_start, src_start, len);
+
+	collectGarbage(curr_versions, depth);
+
+	// The tables have to be up to date for the source; anything cached for
+	// the destination is overwritten anyway.
+	cache->flushRange((Addr)src_start, len, curr_versions);
+	cache->invalidate((Addr)dest_start, len);
+
+	unsigned words_per_page = MemorySegment::GetPageSize() >> 3;
+	range_times.resize((depth + 1) * words_per_page);
+	Time* times = &range_times[0];
+
+	// like memmove, go backwards if the destination overlaps the end of
+	// the source
+	bool backward = dest_start > src_start && dest_start < src_start + len;
+	UInt64 offset = backward ? len : 0;
+	while (backward ? offset > 0 : offset < len) {
+		UInt64 piece = getPieceSize(dest_start, src_start, offset, len, backward);
+		UInt64 piece_offset = backward ? offset - piece : offset;
+		Addr piece_dest = (Addr)(dest_start + piece_offset);
+		Addr piece_src = (Addr)(src_start + piece_offset);
+		unsigned num_words = piece >> 3;
+
+		// read the whole piece first: it may overlap its own destination
+		LevelTable* srcTable = findLevelTable(piece_src, curr_versions);
+		if (srcTable != NULL) {
+			srcTable->getTimesInRange(piece_src, (char*)piece_src + piece, 
+										depth, curr_versions, times);
+		}
+		else {
+			memset(times, 0, sizeof(Time) * depth * num_words);
+		}
+
+		for (Index i = 0; i < depth; ++i) {
+			Time* row = &times[i * num_words];
+			Time floor = min_times[i];
+			Time latest = max_times[i];
+			for (unsigned w = 0; w < num_words; ++w) {
+				Time t = MAX(row[w], floor) + cost;
+				row[w] = t;
+				latest = MAX(latest, t);
+			}
+			max_times[i] = latest;
+		}
+
+		storeRange(piece_dest, (char*)piece_dest + piece, depth, 
+					curr_versions, times);
+
+		offset = backward ? piece_offset : offset + piece;
+	}
+	eventShadowCopy(num_grains << granularity_shift);
+}
+
+void MShadowSkadu::fill(Addr dest, UInt64 size, Index depth, 
+						Version *curr_versions, Time *times) {
+	if (size == 0 || depth == 0) return;
+
+	if (static_shadow->overlaps(dest, size)) {
+		MShadow::fill(dest, size, depth, curr_versions, times);
+		return;
+	}
+
+	UInt64 num_grains = getGranule((char*)dest + size - 1) - getGranule(dest) + 1;
+	UInt64 start = (UInt64)getShadowAddr(dest);
+	UInt64 end = start + (num_grains << 3);
+	MSG(0, "mshadow fill 0x%llx - 0x%llx\n", start, end);
+
+	collectGarbage(curr_versions, depth);
+	cache->invalidate((Addr)start, end - start);
+
+	unsigned words_per_page = MemorySegment::GetPageSize() >> 3;
+	range_times.resize((depth + 1) * words_per_page);
+
+	UInt64 page_size = MemorySegment::GetPageSize();
+	UInt64 page_end;
+	unsigned filled_words = 0; // row length range_times is set up for
+	for (UInt64 page = start; page < end; page = page_end) {
+		page_end = (page & ~(page_size - 1)) + page_size;
+		if (page_end > end) page_end = end;
+
+		unsigned num_words = (page_end - page) >> 3;
+		if (num_words != filled_words) {
+			for (Index i = 0; i < depth; ++i) {
+				Time* row = &range_times[i * num_words];
+				for (unsigned w = 0; w < num_words; ++w) row[w] = times[i];
+			}
+			filled_words = num_words;
+		}
+
+		storeRange((Addr)page, (Addr)page_end, depth, curr_versions, 
+					&range_times[0]);
+	}
+	eventShadowFill(num_grains << granularity_shift);
+}
+
 static void check(Addr addr, Time* src, int size, int site) {
 #ifndef NDEBUG
 	int i;
@@ -153,6 +455,7 @@ void MemorySegment::operator delete(void* ptr) {
 MemorySegment::MemorySegment() {
 	memset(this->level_tables, 0, 
 			MemorySegment::NUM_ENTRIES * sizeof(LevelTable*));
+	memset(this->written_pages, 0, sizeof(this->written_pages));
 }
 
 MemorySegment::~MemorySegment() {
@@ -165,26 +468,49 @@ MemorySegment::~MemorySegment() {
 	}
 }
 
+void MShadowSkadu::store(Addr addr, Index size, Version *curr_versions, 
+							Time *timestamps, TimeTable::TableType type) {
+	assert(curr_versions != NULL);
+	assert(timestamps != NULL);
+
+	LevelTable* lTable = this->getLevelTable(addr, curr_versions);
+	if (address_major) {
+		lTable->setTimesForAddr(addr, size, curr_versions, timestamps);
+	}
+	else {
+		lTable->reserveLevels(size);
+		for (Index i = 0; i < size; ++i) {
+			lTable->setTimeForAddrAtLevel(i, addr, curr_versions[i], 
+											timestamps[i], type);
+			MSG(0, "\t\toffset=%u, version=%llu, value=%llu\n", 
+				i, curr_versions[i], timestamps[i]);
+		}
+	}
+
+	if (!LevelTableList::IsListed(lTable))
+		gc_list->push(lTable);
+
+	if (useCompression())
+		compression_buffer->touch(lTable);
+}
+
 void MShadowSkadu::evict(Time *new_timestamps, Addr addr, Index size, Version *curr_versions, TimeTable::TableType type) {
 	assert(new_timestamps != NULL);
 	assert(curr_versions != NULL);
 
 	MSG(0, "\tmshadow evict 0x%llx, size=%u, effectiveSize=%u \n", addr, size, size);
-		
-	LevelTable* lTable = this->getLevelTable(addr,curr_versions);
-	for (unsigned i = 0; i < size; ++i) {
-		eventEvict(i);
-		if (new_timestamps[i] == 0ULL) { break; }
-		lTable->setTimeForAddrAtLevel(i, addr, curr_versions[i], 
-										new_timestamps[i], type);
-		MSG(0, "\t\toffset=%u, version=%llu, value=%llu\n", 
-			i, curr_versions[i], new_timestamps[i]);
+
+	// only levels up to the first zero timestamp are written back
+	Index effective_size = 0;
+	while (effective_size < size) {
+		eventEvict(effective_size);
+		if (new_timestamps[effective_size] == 0ULL) { break; }
+		++effective_size;
 	}
+
+	this->store(addr, effective_size, curr_versions, new_timestamps, type);
 	eventCacheEvict(size, size);
 
-	if (useCompression())
-		compression_buffer->touch(lTable);
-	
 	check(addr, new_timestamps, size, 3);
 }
 
@@ -196,25 +522,61 @@ void MShadowSkadu::fetch(Addr addr, Index size, Version *curr_versions,
 	MSG(3, "\tmshadow fetch 0x%llx, size %u\n", addr, size);
 	LevelTable* lTable = this->getLevelTable(addr, curr_versions);
 
-	for (Index i = 0; i < size; ++i) {
-		timestamps[i] = lTable->getTimeForAddrAtLevel(i, addr, 
-															curr_versions[i]);
+	if (address_major) {
+		lTable->getTimesForAddr(addr, size, curr_versions, timestamps);
+	}
+	else {
+		for (Index i = 0; i < size; ++i) {
+			timestamps[i] = lTable->getTimeForAddrAtLevel(i, addr, 
+																curr_versions[i]);
+		}
 	}
 
 	if (useCompression())
 		compression_buffer->touch(lTable);
 }
 
+void MShadowSkadu::collectGarbage(Version *curr_versions, int size) {
+	// Collection is incremental: a cycle starts once enough TimeTables
+	// have been allocated and then advances a bounded step per set().
+	if (gc_cursor == NULL && getActiveTimeTableSize() >= next_gc_time) {
+		eventGC();
+		gc_cursor = gc_list->getHead();
+		//next_gc_time = stat.nTimeTableActive + garbage_collection_period;
+		next_gc_time += garbage_collection_period;
+	}
+	if (gc_cursor != NULL)
+		runGarbageCollectorStep(curr_versions, size);
+
+	if (mem_limit > 0 && --sets_until_budget_check == 0) {
+		sets_until_budget_check = BUDGET_CHECK_PERIOD;
+		enforceMemLimit(curr_versions, size);
+	}
+}
+
 Time* MShadowSkadu::get(Addr addr, Index size, Version *curr_versions, 
 						UInt32 width) {
 	assert(curr_versions != NULL);
 
 	if (size < 1) return NULL;
 
-	TimeTable::TableType type = TimeTable::TYPE_64BIT; // FIXME: assumes 64 bit
+	if (static_shadow->contains(addr))
+		return static_shadow->get(addr, size, curr_versions);
+
+	// each granule has a single 64 bit entry, whatever its size
+	TimeTable::TableType type = TimeTable::TYPE_64BIT;
 
-	Addr tAddr = (Addr)((UInt64)addr & ~(UInt64)0x7);
+	Addr tAddr = getShadowAddr(addr);
 	MSG(0, "mshadow get 0x%llx, size %u \n", tAddr, size);
+
+	// nothing was ever stored to this page (e.g. input data initialized
+	// before profiling), so there is nothing to look up
+	if (!isPageWritten(tAddr)) {
+		eventReadUnwritten();
+		if (zero_times.size() < size) zero_times.resize(size, 0);
+		return &zero_times[0];
+	}
+
 	eventRead();
 
 	return cache->get(tAddr, size, curr_versions, type);
@@ -228,18 +590,20 @@ void MShadowSkadu::set(Addr addr, Index size, Version *curr_versions,
 	MSG(0, "mshadow set 0x%llx, size %u [", addr, size);
 	if (size < 1) return;
 
-	if (getActiveTimeTableSize() >= next_gc_time) {
-		runGarbageCollector(curr_versions, size);
-		//next_gc_time = stat.nTimeTableActive + garbage_collection_period;
-		next_gc_time += garbage_collection_period;
+	if (static_shadow->contains(addr)) {
+		static_shadow->set(addr, size, curr_versions, timestamps);
+		return;
 	}
 
+	collectGarbage(curr_versions, size);
+
 	//TimeTable::TableType type = (width > 4) ? TimeTable::TYPE_64BIT: TimeTable::TYPE_32BIT;
 	TimeTable::TableType type = TimeTable::TYPE_64BIT;
 
 
-	Addr tAddr = (Addr)((UInt64)addr & ~(UInt64)0x7);
+	Addr tAddr = getShadowAddr(addr);
 	MSG(0, "]\n");
+	markPageWritten(tAddr);
 	eventWrite();
 	cache->set(tAddr, size, curr_versions, timestamps, type);
 }
@@ -249,34 +613,104 @@ void MShadowSkadu::init() {
 	MSG(1,"MShadow Init with cache %d MB, TimeTableSize = %ld\n",
 		cacheSizeMB, sizeof(TimeTable));
 
+	address_major = 
+		(kremlin_config.getShadowMemLayout() == ShadowLayoutAddressMajor);
+
+	granularity = kremlin_config.getShadowGranularity();
+	granularity_shift = 0;
+	while ((1U << granularity_shift) < granularity) ++granularity_shift;
+	assert((1U << granularity_shift) == granularity);
+	MSG(0, "MShadow granularity: %u bytes\n", granularity);
+
+	static_shadow = new StaticShadow();
+	static_shadow->init(granularity_shift);
+
+	// compression works on per-level TimeTables
+	compression_enabled = kremlin_config.compressShadowMem();
+	if (compression_enabled && address_major) {
+		fprintf(stderr, "[kremlin] WARNING: shadow memory compression is not "
+				"supported with the address-major layout; disabling it.\n");
+		compression_enabled = false;
+	}
+
+	// With a memory budget, compression is held in reserve: nothing goes
+	// through the compression buffer until the budget runs short, and then
+	// every table stays uncompressed unless enforceMemLimit shrinks it.
+	mem_limit = (UInt64)kremlin_config.getMemLimitInMB() << 20;
+	compression_buffer_size = kremlin_config.getNumCompressionBufferEntries();
+	compression_reserved = 
+		(mem_limit > 0 && !compression_enabled && !address_major);
+	if (compression_reserved) compression_buffer_size = UINT_MAX;
+	sets_until_budget_check = BUDGET_CHECK_PERIOD;
+	budget_warned = false;
+	budget_stalled_usage = 0;
+
+	// only compressed level tables are spilled
+	if (kremlin_config.spillShadowMem() && !compression_enabled 
+		&& !compression_reserved) {
+		fprintf(stderr, "[kremlin] WARNING: spilling shadow memory to disk "
+				"needs shadow memory compression; not spilling.\n");
+	}
+
+	// The cache allocates its tables from the small pool, so the pools
+	// have to exist before the cache is configured.
+	unsigned size = TimeTable::GetNumEntries(TimeTable::TYPE_64BIT);
+	MemPoolInit(1024, size * sizeof(Time));
+
 	if (cacheSizeMB > 0) 
 		cache = new SkaduCache();
 	else
 		cache = new NullCache();
 
-	cache->init(cacheSizeMB, kremlin_config.compressShadowMem(), this);
+	unsigned l0_entries = kremlin_config.getShadowMemL0Entries();
+	if (l0_entries > 0)
+		cache = new L0Cache(cache, l0_entries);
 
-	unsigned size = TimeTable::GetNumEntries(TimeTable::TYPE_64BIT);
-	MemPoolInit(1024, size * sizeof(Time));
+	cache->init(cacheSizeMB, compression_enabled, this);
 	
 	initGarbageCollector(kremlin_config.getShadowMemGarbageCollectionPeriod());
  
-	sparse_table = new SparseTable();
+	sparse_table = new SparseTable<MemorySegment>();
 	sparse_table->init();
 
 	compression_buffer = new CBuffer();
-	compression_buffer->init(kremlin_config.getNumCompressionBufferEntries());
-	compression_enabled = kremlin_config.compressShadowMem();
+	compression_buffer->init(compression_buffer_size, compression_enabled);
+
+	MShadowStatStartTLBCounters();
 }
 
 
 void MShadowSkadu::deinit() {
+	compression_buffer->stopWorker();
 	cache->deinit();
 	delete cache;
 	cache = NULL;
+	MShadowStatPrint();
+
+	// the tables themselves are deleted with their MemorySegment
+	gc_list->clear();
+	delete gc_list;
+	gc_list = NULL;
+	gc_cursor = NULL;
+
+	for (unsigned i = 0; i < sparse_table->getNumElements(); ++i) {
+		SparseTable<MemorySegment>::Element* e = 
+			sparse_table->getElementAtIndex(i);
+		delete e->segTable;
+		e->segTable = NULL;
+		eventSegTableFree();
+	}
+	sparse_table->deinit();
+	delete sparse_table;
+	sparse_table = NULL;
+
+	static_shadow->deinit();
+	delete static_shadow;
+	static_shadow = NULL;
+
+	// compressed LevelTables return their payloads to the compression
+	// buffer's pool, so it goes away last
 	compression_buffer->deinit();
 	delete compression_buffer;
 	compression_buffer = NULL;
-	MShadowStatPrint();
-	sparse_table->deinit();
 }
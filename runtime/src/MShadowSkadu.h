@@ -2,35 +2,187 @@
 #define _MSHADOW_SKADU_H
 
 #include <cassert>
+#include <vector>
 #include "ktypes.h"
 #include "MShadow.h" // for MShadow class 
 #include "TimeTable.hpp" // for TimeTable::TableType
 
-class SparseTable;
+template <typename Segment> class SparseTable;
 class MemorySegment;
 class LevelTable;
+class LevelTableList;
 class CacheInterface;
 class CBuffer;
+class StaticShadow;
 
 class MShadowSkadu : public MShadow {
 private:
-	SparseTable *sparse_table; 
+	SparseTable<MemorySegment> *sparse_table; 
 
 	UInt64 next_gc_time;
 	unsigned garbage_collection_period;
 
+	/*!
+	 * LevelTables that may hold live timestamps. Tables are added when
+	 * timestamps are stored and dropped once the collector empties them.
+	 */
+	LevelTableList *gc_list;
+	LevelTable *gc_cursor; //!< next table to collect, NULL between cycles
+
+	//! Maximum number of LevelTables collected per set()
+	static const unsigned GC_TABLES_PER_STEP = 64;
+
 	void initGarbageCollector(unsigned period);
-	void runGarbageCollector(Version *curr_versions, int size);
 
-	CacheInterface *cache; //!< The cache associated with shadow mem
+	/*!
+	 * Starts a collection cycle when enough TimeTables have been allocated,
+	 * advances the current one and checks the memory budget. Called once
+	 * per set(), copy() and fill().
+	 */
+	void collectGarbage(Version *curr_versions, int size);
+
+	/*!
+	 * Collects up to GC_TABLES_PER_STEP tables of the current cycle,
+	 * starting at gc_cursor.
+	 *
+	 * @pre gc_cursor is non-NULL.
+	 */
+	void runGarbageCollectorStep(Version *curr_versions, int size);
+
+	/*
+	 * Memory budget (--kremlin-mem-limit). Usage is checked every
+	 * BUDGET_CHECK_PERIOD set()s; past BUDGET_SOFT_PERCENT of the limit
+	 * enforceMemLimit escalates from garbage collection to compression.
+	 * Once usage is below BUDGET_RESTORE_PERCENT again, the compression
+	 * buffer gets its old size back.
+	 */
+	UInt64 mem_limit; //!< in bytes, 0 if there is no budget
+	UInt64 sets_until_budget_check;
+	bool budget_warned; //!< warned that the budget can't be met
+	UInt64 budget_stalled_usage; //!< usage after a pass that reclaimed nothing, else 0
+	static const unsigned BUDGET_CHECK_PERIOD = 4096;
+	static const unsigned BUDGET_SOFT_PERCENT = 80;
+	static const unsigned BUDGET_RESTORE_PERCENT = 60;
+	static const unsigned BUDGET_RETRY_PERCENT = 5; //!< growth before retrying a stalled pass
+	static const unsigned MIN_UNCOMPRESSED_TABLES = 16;
+
+	/*!
+	 * Returns the bytes of RAM used by shadow memory, the shadow cache and
+	 * the small pool (which also holds the region tree).
+	 */
+	UInt64 getMemUsage();
+
+	/*!
+	 * Frees memory, as much as needed to get back under the soft limit:
+	 * first by running a full garbage collection cycle, then by compressing
+	 * half of the uncompressed tables.
+	 */
+	void enforceMemLimit(Version *curr_versions, int size);
+
+	/*!
+	 * The cache associated with shadow mem; with --kremlin-shadow-mem-l0-entries
+	 * this is an L0Cache wrapping the SkaduCache or NullCache.
+	 */
+	CacheInterface *cache;
+
+	//! Shadow for global and static data, which bypasses everything else
+	StaticShadow *static_shadow;
+
+	/*
+	 * Shadow granularity (--kremlin-shadow-granularity). Everything below
+	 * get/set, i.e. the cache, the LevelTables and their TimeTables, works
+	 * on shadow addresses in which each granule of program memory takes a
+	 * single 8 byte word. A coarser granularity packs more program memory
+	 * into each TimeTable and cache line.
+	 */
+	unsigned granularity_shift; //!< log2 of the granularity
+
+	/*!
+	 * Returns the shadow address of the granule holding addr.
+	 */
+	Addr getShadowAddr(Addr addr) {
+		return (Addr)(((UInt64)addr >> granularity_shift) << 3);
+	}
+
+	/*!
+	 * Returns the number of the granule holding addr.
+	 */
+	UInt64 getGranule(Addr addr) {
+		return (UInt64)addr >> granularity_shift;
+	}
 
 	bool compression_enabled; //!< Indicates whether we should use compression
+	bool address_major; //!< Store all levels of a word contiguously
 	CBuffer *compression_buffer;
+	unsigned compression_buffer_size; //!< uncompressed tables allowed while under budget
+
+	/*!
+	 * With a budget but without --kremlin-compress-shadow-mem, compression
+	 * is held in reserve: it is started (see startCompression) only when
+	 * the budget first runs short.
+	 */
+	bool compression_reserved;
+
+	/*!
+	 * Turns compression on and puts every existing LevelTable in the
+	 * compression buffer.
+	 *
+	 * @pre compression is reserved and not enabled yet.
+	 */
+	void startCompression();
 
 	bool useCompression() {
 		return compression_enabled;
 	}
 
+	/*!
+	 * Makes sure a LevelTable's TimeTables are uncompressed (or takes it off
+	 * the compression queue) before it is accessed.
+	 *
+	 * @pre l_table and curr_versions are non-NULL.
+	 */
+	void prepareLevelTable(LevelTable *l_table, Version *curr_versions);
+
+	/*!
+	 * Returns the MemorySegment holding addr, creating it if needed.
+	 */
+	MemorySegment* getMemorySegment(Addr addr);
+
+	/*
+	 * Pages (of shadow addresses) that have never been written are tracked
+	 * in their MemorySegment so that get() can answer loads from them with
+	 * zeros without going through the cache or allocating LevelTables.
+	 * A page is marked as soon as a timestamp for it is handed to the
+	 * cache, and unmarked when clear() empties all of it.
+	 */
+	bool isPageWritten(Addr addr);
+	void markPageWritten(Addr addr);
+
+	//! What get() returns for pages that were never written.
+	std::vector<Time> zero_times;
+
+	/*!
+	 * Returns the (prepared) LevelTable for addr, or NULL if there is none.
+	 * Unlike getLevelTable, nothing is allocated.
+	 *
+	 * @pre curr_versions is non-NULL.
+	 */
+	LevelTable* findLevelTable(Addr addr, Version *curr_versions);
+
+	//! Scratch timestamps for a page, one row of words per level.
+	std::vector<Time> range_times;
+
+	/*!
+	 * Writes timestamps for all words in [start, end) and all levels up to
+	 * size into the backing LevelTable.
+	 *
+	 * @param times The timestamps, one row of words per level.
+	 * @pre The range is word aligned and within a single page.
+	 * @pre times points into range_times, which has room for one more row.
+	 */
+	void storeRange(Addr start, Addr end, Index size, Version *curr_versions, 
+					Time *times);
+
 public:
 	void init();
 	void deinit();
@@ -43,6 +195,27 @@ public:
 	void set(Addr addr, Index size, Version *curr_versions, 
 				Time *timestamps, UInt32 width);
 
+	/*!
+	 * Drops the timestamps of [addr, addr+size) from the cache and the
+	 * LevelTables. Pages that are entirely inside the range give their
+	 * TimeTables back to the pool.
+	 *
+	 * @pre curr_versions is non-NULL.
+	 */
+	void clear(Addr addr, UInt64 size, Version *curr_versions);
+
+	/*!
+	 * Copies a page at a time straight between LevelTables, after writing
+	 * the source range back from the cache. Falls back to word by word
+	 * copies if source and destination aren't equally aligned.
+	 */
+	void copy(Addr dest, Addr src, UInt64 size, Index depth, 
+				Version *curr_versions, Time *min_times, Time cost, 
+				Time *max_times);
+
+	void fill(Addr dest, UInt64 size, Index depth, Version *curr_versions, 
+				Time *times);
+
 	CBuffer* getCompressionBuffer() { return compression_buffer; }
 
 	/*!
@@ -51,6 +224,15 @@ public:
 	void fetch(Addr addr, Index size, Version *curr_versions, 
 				Time *timestamps, TimeTable::TableType type);
 
+	/*!
+	 * Writes timestamps for all levels up to size into the backing
+	 * LevelTable, using whichever layout was selected at init.
+	 *
+	 * @pre curr_versions and timestamps are non-NULL.
+	 */
+	void store(Addr addr, Index size, Version *curr_versions, 
+				Time *timestamps, TimeTable::TableType type);
+
 	/*!
 	 * @pre new_timestamps and curr_versions are non-NULL.
 	 */
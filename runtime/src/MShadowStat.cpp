@@ -1,3 +1,12 @@
+#include <stdio.h>
+#include <stdlib.h> // for strtoull
+#include <string.h> // for memset
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
 #include "debug.h"
 #include "kremlin.h"
 #include "config.h"
@@ -6,6 +15,7 @@
 #include "LevelTable.hpp"
 #include "MShadowStat.h"
 #include "MShadowSkadu.h"
+#include "MemMapAllocator.h"
 
 MemStat _stat;
 L1Stat _cacheStat;
@@ -13,12 +23,13 @@ L1Stat _cacheStat;
 
 
 /*
- * Cache size when a specific # of levels are used
+ * Cache size when a specific # of levels are used. The configured size
+ * bounds everything the cache allocates, whatever the depth.
  */
 static int cacheMB;
 double getCacheSize(int level) {
 	int cacheSize = kremlin_config.getShadowMemCacheSizeInMB();
-	return (double)(cacheSize* 4.0 + level * cacheSize * 2);
+	return (double)cacheSize;
 }
 
 static double getSizeMB(UInt64 nUnit, UInt64 size) {
@@ -31,17 +42,49 @@ void printCacheStat() {
 		_cacheStat.nRead, _cacheStat.nReadHit, _cacheStat.nReadEvict);
 	MSG(0, "\twrite all / hit / evict = %llu / %llu / %llu\n", 
 		_cacheStat.nWrite, _cacheStat.nWriteHit, _cacheStat.nWriteEvict);
-	double hitRead = _cacheStat.nReadHit * 100.0 / _cacheStat.nRead;
-	double hitWrite = _cacheStat.nWriteHit * 100.0 / _cacheStat.nWrite;
-	double hit = (_cacheStat.nReadHit + _cacheStat.nWriteHit) * 100.0 / (_cacheStat.nRead + _cacheStat.nWrite);
+	MSG(0, "\treads of never-written pages (bypassed cache) = %llu\n", 
+		_cacheStat.nReadUnwritten);
+	UInt64 l0Read = _cacheStat.nL0ReadHit + _cacheStat.nL0ReadMiss;
+	UInt64 l0Write = _cacheStat.nL0WriteHit + _cacheStat.nL0WriteMiss;
+	if (l0Read + l0Write > 0) {
+		MSG(0, "\tL0 hit (read / write / overall) = %.2f / %.2f / %.2f, write-back = %llu\n", 
+			_cacheStat.nL0ReadHit * 100.0 / l0Read, 
+			_cacheStat.nL0WriteHit * 100.0 / l0Write,
+			(_cacheStat.nL0ReadHit + _cacheStat.nL0WriteHit) * 100.0 / (l0Read + l0Write),
+			_cacheStat.nL0WriteBack);
+	}
+
+	// Behind an L0, the cache only sees L0 misses and write-backs, so
+	// count what actually reached it.
+	UInt64 nRead = _cacheStat.nRead;
+	UInt64 nWrite = _cacheStat.nWrite;
+	UInt64 cacheRead = _cacheStat.nReadHit + _cacheStat.nReadEvict;
+	UInt64 cacheWrite = _cacheStat.nWriteHit + _cacheStat.nWriteEvict;
+	if (l0Read + l0Write > 0 && cacheRead + cacheWrite > 0) {
+		nRead = cacheRead;
+		nWrite = cacheWrite;
+	}
+	double hitRead = _cacheStat.nReadHit * 100.0 / nRead;
+	double hitWrite = _cacheStat.nWriteHit * 100.0 / nWrite;
+	double hit = (_cacheStat.nReadHit + _cacheStat.nWriteHit) * 100.0 / (nRead + nWrite);
 	MSG(0, "\tCache hit (read / write / overall) = %.2f / %.2f / %.2f\n", 
 		hitRead, hitWrite, hit);
+	MSG(0, "\tmiss conflict / capacity = %llu / %llu, victim buffer hit = %llu\n", 
+		_cacheStat.nMissConflict, _cacheStat.nMissCapacity, 
+		_cacheStat.nVictimHit);
+	MSG(0, "\twrite-back dirty / dropped clean = %llu / %llu\n", 
+		_cacheStat.nWriteBack, _cacheStat.nCleanDrop);
+	MSG(0, "\tlines emptied for slab space / accesses bypassing the slab = %llu / %llu\n", 
+		_cacheStat.nSlabEvict, _cacheStat.nSlabBypass);
 	MSG(0, "\tEvict (total / levelAvg / levelEffective) = %llu / %.2f / %.2f\n\n", 
 		_cacheStat.nCacheEvict, 
 		(double)_cacheStat.nCacheEvictLevelTotal / _cacheStat.nCacheEvict, 
 		(double)_cacheStat.nCacheEvictLevelEffective / _cacheStat.nCacheEvict);
 
 	MSG(0, "\tnGC = %llu\n", _stat.nGC);
+	MSG(0, "\tGC steps / pause total (ms) / pause max (us) / reclaimed (MB) = %llu / %.2f / %llu / %.2f\n",
+		_stat.nGCStep, _stat.gcPauseUsec / 1000.0, _stat.gcPauseMaxUsec, 
+		getSizeMB(_stat.gcReclaimedBytes, 1));
 }
 
 
@@ -49,7 +92,14 @@ void printMemReqStat() {
 	//fprintf(stderr, "Overall allocated = %d, converted = %d, realloc = %d\n", 
 	//	totalAlloc, totalConvert, totalRealloc);
 	double segSize = getSizeMB(_stat.segTable.nActiveMax, sizeof(MemorySegment));
-	double lTableSize = getSizeMB(_stat.lTable.nActiveMax, sizeof(LevelTable));
+	double lTableSize = getSizeMB(_stat.lTable.nActiveMax, sizeof(LevelTable))
+		+ getSizeMB(_stat.nLevelEntriesMax, LevelTable::GetLevelStorageSize(1));
+
+	// what LevelTables would take if each had room for FIXED_LEVELS levels
+	const unsigned FIXED_LEVELS = 64;
+	double lTableSizeFixed = getSizeMB(_stat.lTable.nActiveMax, 
+		sizeof(LevelTable) + LevelTable::GetLevelStorageSize(FIXED_LEVELS));
+	(void)lTableSizeFixed; // only reported in debug builds
 
 	UInt64 nTable0 = _stat.tTable[0].nActiveMax;
 	UInt64 nTable1 = _stat.tTable[1].nActiveMax;
@@ -76,6 +126,8 @@ void printMemReqStat() {
 	MSG(0, "\nRequired Memory Analysis\n");
 	MSG(0, "\tShadowMemory (MemorySegment / LevTable/ TTable / TTableCompressed) = %.2f / %.2f/ %.2f / %.2f \n",
 		segSize, lTableSize, tTableSize, tTableSizeWithCompression);
+	MSG(0, "\tLevTable (Depth-Proportional / Fixed %u Levels / Saved) = %.2f / %.2f / %.2f\n",
+		FIXED_LEVELS, lTableSize, lTableSizeFixed, lTableSizeFixed - lTableSize);
 	MSG(0, "\tReqMemSize (Total / Cache / Uncompressed Shadow / Compressed Shadow) = %.2f / %.2f / %.2f / %.2f\n",
 		totalSize, cacheSize, segSize + tTableSize, segSize + tTableSizeWithCompression);  
 	MSG(0, "\tTagTable (Uncompressed / Compressed / Ratio / Comp Ratio) = %.2f / %.2f / %.2f / %.2f\n",
@@ -131,10 +183,140 @@ void printLevelStat() {
 #endif
 }
 
+#ifdef KREMLIN_DEBUG
+/*
+ * dTLB misses of the whole process, counted in user mode only so that an
+ * unprivileged process can count them. Not all CPUs (or VMs) expose these
+ * events, in which case the fds stay -1.
+ */
+static int dtlbLoadMissFd = -1;
+static int dtlbStoreMissFd = -1;
+
+#ifdef __linux__
+static int openTLBCounter(UInt64 op) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (op << 8) | 
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void MShadowStatStartTLBCounters() {
+#ifdef __linux__
+	dtlbLoadMissFd = openTLBCounter(PERF_COUNT_HW_CACHE_OP_READ);
+	dtlbStoreMissFd = openTLBCounter(PERF_COUNT_HW_CACHE_OP_WRITE);
+#endif
+}
+
+static UInt64 readTLBCounter(int fd) {
+	UInt64 count = 0;
+	if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+		return 0;
+	return count;
+}
+
+/*
+ * Returns the kB of anonymous memory the kernel backs with transparent
+ * huge pages, or 0 if it doesn't say.
+ */
+static UInt64 getAnonHugePagesKB() {
+	UInt64 total_kb = 0;
+	FILE* smaps = fopen("/proc/self/smaps", "r");
+	if (smaps == NULL) return 0;
+
+	char line[256];
+	unsigned long long kb;
+	while (fgets(line, sizeof(line), smaps) != NULL) {
+		if (sscanf(line, "AnonHugePages: %llu kB", &kb) == 1)
+			total_kb += kb;
+	}
+	fclose(smaps);
+	return total_kb;
+}
+
+static void printTLBStat() {
+	MSG(0, "\nTLB Stat\n");
+	MSG(0, "\thuge pages mapped (explicit / transparent advised / transparent in use) MB = %.2f / %.2f / %.2f\n",
+		getSizeMB(_stat.hugeTLBBytes, 1), getSizeMB(_stat.hugeTHPBytes, 1),
+		getAnonHugePagesKB() / 1024.0);
+
+	if (dtlbLoadMissFd < 0) {
+		MSG(0, "\tdTLB misses = unavailable\n");
+		return;
+	}
+	UInt64 loadMisses = readTLBCounter(dtlbLoadMissFd);
+	UInt64 storeMisses = readTLBCounter(dtlbStoreMissFd);
+	UInt64 accesses = _cacheStat.nRead + _cacheStat.nWrite;
+	MSG(0, "\tdTLB misses (load / store / per shadow access) = %llu / %llu / %.3f\n",
+		loadMisses, storeMisses, (double)(loadMisses + storeMisses) / accesses);
+
+	close(dtlbLoadMissFd);
+	if (dtlbStoreMissFd >= 0) close(dtlbStoreMissFd);
+	dtlbLoadMissFd = dtlbStoreMissFd = -1;
+}
+#else
+void MShadowStatStartTLBCounters() {}
+static void printTLBStat() {}
+#endif
+
+#ifdef KREMLIN_DEBUG
+/*
+ * Returns the kB value of a field in /proc/self/status (e.g. VmRSS), or 0
+ * if there is no such field.
+ */
+static UInt64 getProcStatusKB(const char* field) {
+	UInt64 ret = 0;
+	FILE* status = fopen("/proc/self/status", "r");
+	if (status == NULL) return 0;
+
+	char line[256];
+	size_t len = strlen(field);
+	while (fgets(line, sizeof(line), status) != NULL) {
+		if (strncmp(line, field, len) == 0 && line[len] == ':') {
+			ret = strtoull(line + len + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(status);
+	return ret;
+}
+#endif
+
+static void printResidentStat() {
+	MSG(0, "\nResident Memory Stat\n");
+	MSG(0, "\tTimeTable chunks resident (current / peak) MB = %.2f / %.2f\n",
+		getSizeMB(_stat.chunkResidentBytes, 1), 
+		getSizeMB(_stat.chunkResidentBytesMax, 1));
+	MSG(0, "\tTimeTable chunks released to OS (MB / madvise calls) = %.2f / %llu\n",
+		getSizeMB(_stat.chunkReleasedBytes, 1), _stat.nChunkRelease);
+	MSG(0, "\tshadow ranges cleared (count / MB) = %llu / %.2f\n",
+		_stat.nShadowClear, getSizeMB(_stat.shadowClearedBytes, 1));
+	MSG(0, "\tshadow ranges copied / filled (count / MB) = %llu / %.2f, %llu / %.2f\n",
+		_stat.nShadowCopy, getSizeMB(_stat.shadowCopiedBytes, 1),
+		_stat.nShadowFill, getSizeMB(_stat.shadowFilledBytes, 1));
+	MSG(0, "\tstatic data shadow (reads / writes / MB reserved) = %llu / %llu / %.2f\n",
+		_stat.nStaticRead, _stat.nStaticWrite, 
+		getSizeMB(_stat.staticReservedBytes, 1));
+	MSG(0, "\tsmall pool mapped MB = %.2f\n", 
+		getSizeMB(MemPoolGetSmallPoolBytes(), 1));
+	MSG(0, "\tprocess RSS (current / peak) MB = %.2f / %.2f\n",
+		getProcStatusKB("VmRSS") / 1024.0, getProcStatusKB("VmHWM") / 1024.0);
+	MSG(0, "\tmemory limit (MB / peak usage MB / forced GC / forced compression) = %u / %.2f / %llu / %llu\n",
+		kremlin_config.getMemLimitInMB(), getSizeMB(_stat.memUsageMax, 1),
+		_stat.nMemLimitGC, _stat.nMemLimitCompress);
+}
+
 void MShadowStatPrint() {
 	printMemStatAllocation();
 	//printLevelStat();
 	printCacheStat();
 	printMemReqStat();
+	printResidentStat();
+	printTLBStat();
 }
 
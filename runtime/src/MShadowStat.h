@@ -5,6 +5,13 @@
 
 void MShadowStatPrint();
 
+/*!
+ * Starts counting dTLB misses (where the OS lets us) so MShadowStatPrint
+ * can report them. Does nothing unless KREMLIN_DEBUG is defined, since the
+ * stats only go to the debug log.
+ */
+void MShadowStatStartTLBCounters();
+
 /*
  * Allocation Stat Structure
  */
@@ -71,7 +78,39 @@ typedef struct _MemStat {
 
 	AStat lTable;
 
-	UInt64 nGC;
+	// number of levels allocated across all LevelTables
+	UInt64 nLevelEntries;
+	UInt64 nLevelEntriesMax;
+
+	UInt64 nGC;			// garbage collection cycles started
+	UInt64 nGCStep;		// incremental steps run
+	UInt64 gcPauseUsec;	// total time spent in steps
+	UInt64 gcPauseMaxUsec;	// longest single step
+	UInt64 gcReclaimedBytes;	// timestamp memory freed by the collector
+
+	UInt64 hugeTLBBytes;	// mapped with explicit huge pages
+	UInt64 hugeTHPBytes;	// mapped and advised to use transparent huge pages
+
+	// TimeTable chunks whose pages are resident, in use or free
+	UInt64 chunkResidentBytes;
+	UInt64 chunkResidentBytesMax;
+	UInt64 nChunkRelease;		// madvise calls giving chunks back to the OS
+	UInt64 chunkReleasedBytes;
+
+	UInt64 nShadowClear;		// ranges dropped, e.g. on free
+	UInt64 shadowClearedBytes;
+	UInt64 nShadowCopy;			// bulk copies, e.g. for memcpy
+	UInt64 shadowCopiedBytes;
+	UInt64 nShadowFill;			// bulk fills, e.g. for memset
+	UInt64 shadowFilledBytes;
+
+	UInt64 nStaticRead;			// accesses to global and static data
+	UInt64 nStaticWrite;
+	UInt64 staticReservedBytes;	// level arrays mapped for them
+
+	UInt64 memUsageMax;		// peak usage seen by memory budget checks
+	UInt64 nMemLimitGC;		// budget checks that forced a GC cycle
+	UInt64 nMemLimitCompress;	// budget checks that compressed tables
 
 	// tracking overhead of timetables (in bytes) with compression
 	UInt64 timeTableOverhead;
@@ -86,6 +125,13 @@ static inline void eventLevelTableAlloc() {
 	AStatAlloc(&_stat.lTable);
 }
 
+static inline void eventLevelTableResize(UInt64 old_levels, UInt64 new_levels) {
+	_stat.nLevelEntries += new_levels;
+	_stat.nLevelEntries -= old_levels;
+	if (_stat.nLevelEntriesMax < _stat.nLevelEntries)
+		_stat.nLevelEntriesMax = _stat.nLevelEntries;
+}
+
 static inline void eventTimeTableNewAlloc(int level, int type) {
 	//_stat.levels[level].nTimeTableNewAlloc++;
 	AStatAlloc(&_stat.levels[level].tTable[type]);
@@ -143,6 +189,78 @@ static inline void eventGC() {
 	_stat.nGC++;
 }
 
+static inline void eventGCStep(UInt64 pause_usec, UInt64 reclaimed_bytes) {
+	_stat.nGCStep++;
+	_stat.gcPauseUsec += pause_usec;
+	if (_stat.gcPauseMaxUsec < pause_usec)
+		_stat.gcPauseMaxUsec = pause_usec;
+	_stat.gcReclaimedBytes += reclaimed_bytes;
+}
+
+static inline void eventHugePageMap(bool explicit_pages, UInt64 bytes) {
+	if (explicit_pages) _stat.hugeTLBBytes += bytes;
+	else _stat.hugeTHPBytes += bytes;
+}
+
+static inline void eventShadowResident(UInt64 bytes) {
+	_stat.chunkResidentBytes += bytes;
+	if (_stat.chunkResidentBytesMax < _stat.chunkResidentBytes)
+		_stat.chunkResidentBytesMax = _stat.chunkResidentBytes;
+}
+
+static inline void eventShadowRelease(UInt64 num_ranges, UInt64 bytes) {
+	_stat.nChunkRelease += num_ranges;
+	_stat.chunkReleasedBytes += bytes;
+	_stat.chunkResidentBytes -= bytes;
+}
+
+static inline UInt64 getChunkResidentBytes() {
+	return _stat.chunkResidentBytes;
+}
+
+static inline void eventShadowClear(UInt64 bytes) {
+	_stat.nShadowClear++;
+	_stat.shadowClearedBytes += bytes;
+}
+
+static inline void eventShadowCopy(UInt64 bytes) {
+	_stat.nShadowCopy++;
+	_stat.shadowCopiedBytes += bytes;
+}
+
+static inline void eventShadowFill(UInt64 bytes) {
+	_stat.nShadowFill++;
+	_stat.shadowFilledBytes += bytes;
+}
+
+static inline void eventStaticRead() {
+	_stat.nStaticRead++;
+}
+
+static inline void eventStaticWrite() {
+	_stat.nStaticWrite++;
+}
+
+static inline void eventStaticLevelAlloc(UInt64 bytes) {
+	_stat.staticReservedBytes += bytes;
+}
+
+static inline void eventMemUsage(UInt64 bytes) {
+	if (_stat.memUsageMax < bytes) _stat.memUsageMax = bytes;
+}
+
+static inline void eventMemLimitGC() {
+	_stat.nMemLimitGC++;
+}
+
+static inline void eventMemLimitCompress() {
+	_stat.nMemLimitCompress++;
+}
+
+static inline UInt64 getTimeTableMemSize() {
+	return _stat.timeTableOverhead;
+}
+
 
 static inline UInt64 getActiveTimeTableSize() {
 	return _stat.tTable[0].nActive + _stat.tTable[1].nActive;
@@ -154,12 +272,28 @@ static inline UInt64 getActiveTimeTableSize() {
 
 typedef struct _L1Stat {
 	UInt64 nRead;
+	UInt64 nReadUnwritten;	// reads of never-written pages (not in nRead)
 	UInt64 nReadHit;
 	UInt64 nReadEvict;
 	UInt64 nWrite;
 	UInt64 nWriteHit;
 	UInt64 nWriteEvict;
 
+	UInt64 nMissConflict;
+	UInt64 nMissCapacity;
+	UInt64 nVictimHit;
+
+	UInt64 nWriteBack;	// dirty line offsets written to shadow memory
+	UInt64 nCleanDrop;	// clean line offsets dropped without write-back
+	UInt64 nSlabEvict;	// lines emptied to make room in the value slab
+	UInt64 nSlabBypass;	// accesses too deep for the value slab
+
+	UInt64 nL0ReadHit;	// reads served by the L0 filter (not in nReadHit)
+	UInt64 nL0ReadMiss;
+	UInt64 nL0WriteHit;	// writes served by the L0 filter (not in nWriteHit)
+	UInt64 nL0WriteMiss;
+	UInt64 nL0WriteBack;	// dirty L0 entries written to the cache behind
+
 	UInt64 nEvictLevel[128];
 	UInt64 nEvictTotal;
 	UInt64 nCacheEvictLevelTotal;
@@ -176,6 +310,10 @@ static inline void eventRead() {
 	_cacheStat.nRead++;
 }
 
+static inline void eventReadUnwritten() {
+	_cacheStat.nReadUnwritten++;
+}
+
 static inline void eventReadHit() {
 	_cacheStat.nReadHit++;
 }
@@ -196,6 +334,54 @@ static inline void eventWriteEvict() {
 	_cacheStat.nWriteEvict++;
 }
 
+static inline void eventCacheConflictMiss() {
+	_cacheStat.nMissConflict++;
+}
+
+static inline void eventCacheCapacityMiss() {
+	_cacheStat.nMissCapacity++;
+}
+
+static inline void eventVictimHit() {
+	_cacheStat.nVictimHit++;
+}
+
+static inline void eventCacheWriteBack() {
+	_cacheStat.nWriteBack++;
+}
+
+static inline void eventCacheCleanDrop() {
+	_cacheStat.nCleanDrop++;
+}
+
+static inline void eventCacheSlabEvict() {
+	_cacheStat.nSlabEvict++;
+}
+
+static inline void eventCacheSlabBypass() {
+	_cacheStat.nSlabBypass++;
+}
+
+static inline void eventL0ReadHit() {
+	_cacheStat.nL0ReadHit++;
+}
+
+static inline void eventL0ReadMiss() {
+	_cacheStat.nL0ReadMiss++;
+}
+
+static inline void eventL0WriteHit() {
+	_cacheStat.nL0WriteHit++;
+}
+
+static inline void eventL0WriteMiss() {
+	_cacheStat.nL0WriteMiss++;
+}
+
+static inline void eventL0WriteBack() {
+	_cacheStat.nL0WriteBack++;
+}
+
 static inline void eventCacheEvict(int total, int effective) {
 	_cacheStat.nCacheEvictLevelTotal += total;
 	_cacheStat.nCacheEvictLevelEffective += effective;
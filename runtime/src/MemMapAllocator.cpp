@@ -3,12 +3,16 @@
  * @brief Defines a pool of memory backed by mmap.
  */
 
+#include <algorithm> // for std::sort
 #include <cstdlib>
 #include <cstdio>
 #include <sys/mman.h>
+#include <vector>
 
 #include "debug.h"
+#include "config.h"
 #include "MemMapAllocator.h"
+#include "MShadowStat.h" // for huge page and resident memory counters
 #include "mpool.h"
 
 typedef struct _MChunk {
@@ -18,16 +22,118 @@ typedef struct _MChunk {
 
 static int chunkSize;
 static int mmapSizeMB;
-static MChunk* freeList;
+static MChunk* freeList;		//!< free chunks that may have resident pages
+static MChunk* releasedList;	//!< free chunks without resident pages
+static UInt64 numResidentFree;	//!< number of chunks in freeList
+static UInt64 releaseThreshold;	//!< freeList length that triggers release
 static mpool_t* poolSmall;
 
 
+static const UInt64 HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static bool useHugePages() {
+	return kremlin_config.getHugePageMode() != HugePagesNone;
+}
+
+/*
+ * With huge pages, mappings are whole huge pages so that MemUnmapAnonymous
+ * can find the size of a mapping without knowing how it was made.
+ */
+static UInt64 getMapSize(UInt64 size) {
+	if (!useHugePages()) return size;
+	return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+#ifdef MAP_HUGETLB
+static void* mapHugeTLB(UInt64 size) {
+	static bool warned = false;
+	void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+						MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (data == MAP_FAILED && !warned) {
+		fprintf(stderr, "[kremlin] WARNING: no explicit huge pages available "
+				"(see /proc/sys/vm/nr_hugepages); using transparent huge "
+				"pages.\n");
+		warned = true;
+	}
+	return data;
+}
+#endif
+
+/*
+ * Asks for transparent huge pages. Only the 2MB aligned parts of a mapping
+ * can get them, so the mapping is aligned by over-allocating and trimming.
+ */
+static void* mapTransparentHuge(UInt64 size) {
+	static bool warned = false;
+	unsigned char* data = (unsigned char*)mmap(NULL, size + HUGE_PAGE_SIZE, 
+						PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED) return MAP_FAILED;
+
+	unsigned char* aligned = (unsigned char*)
+		(((UInt64)data + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+	if (aligned > data) munmap(data, aligned - data);
+	unsigned char* end = data + size + HUGE_PAGE_SIZE;
+	if (end > aligned + size) munmap(aligned + size, end - (aligned + size));
+
+#ifdef MADV_HUGEPAGE
+	if (madvise(aligned, size, MADV_HUGEPAGE) == 0) {
+		eventHugePageMap(false, size);
+	}
+	else if (!warned) {
+		perror("[kremlin] WARNING: madvise(MADV_HUGEPAGE)");
+		warned = true;
+	}
+#endif
+	return aligned;
+}
+
+Addr MemMapAnonymous(UInt64 size) {
+	size = getMapSize(size);
+	void* data = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	if (kremlin_config.getHugePageMode() == HugePagesHugeTLB) {
+		data = mapHugeTLB(size);
+		if (data != MAP_FAILED) eventHugePageMap(true, size);
+	}
+#endif
+	if (data == MAP_FAILED && useHugePages())
+		data = mapTransparentHuge(size);
+	if (data == MAP_FAILED && !useHugePages())
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+						MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	return (data == MAP_FAILED) ? NULL : data;
+}
+
+void MemUnmapAnonymous(Addr addr, UInt64 size) {
+	if (addr == NULL) return;
+	munmap(addr, getMapSize(size));
+}
+
 void MemPoolInit(int nMB, int sizeEach) {
 	mmapSizeMB = nMB;
 	chunkSize = sizeEach;
 	freeList = NULL;	
+	releasedList = NULL;
+	numResidentFree = 0;
+	releaseThreshold = 
+		((UInt64)kremlin_config.getShadowReleaseThresholdInMB() << 20) / sizeEach;
+
+	// explicit huge pages can't be given back a chunk at a time
+	if (kremlin_config.getHugePageMode() == HugePagesHugeTLB)
+		releaseThreshold = 0;
 	int error;
-	poolSmall = mpool_open(0, 0, (void*)0x100000000000, &error);
+
+	// The small pool maps a page at a time, so with huge pages its pages
+	// are made huge page sized.
+	unsigned flags = 0;
+	unsigned page_size = 0;
+	if (useHugePages()) {
+		flags |= MPOOL_FLAG_HUGE_PAGES;
+		page_size = HUGE_PAGE_SIZE;
+	}
+	poolSmall = mpool_open(flags, page_size, (void*)0x100000000000, &error);
 	if (error != 1) {
 		fprintf(stderr, "ERROR (mpool_open): %s\n", mpool_strerror(error)); 
 		assert(0);
@@ -68,40 +174,64 @@ void MChunkFree(MChunk* target) {
 	MemPoolFreeSmall(target, sizeof(MChunk));
 }
 
-void addMChunk(MChunk* toAdd) {
-	MChunk* head = freeList;
+void addMChunk(MChunk** list, MChunk* toAdd) {
+	MChunk* head = *list;
 	toAdd->next = head;
-	freeList = toAdd;
+	*list = toAdd;
 }
 
-static void FillFreeList() {
-	int protection = PROT_READ | PROT_WRITE;
-    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+/*
+ * Gives the pages of free chunks back to the OS until only keep chunks are
+ * left in freeList. Chunks are released in one batch, with adjacent chunks
+ * merged into one madvise call, so the cost of a release is amortized over
+ * many frees.
+ */
+static void releaseFreeChunks(UInt64 keep) {
+	std::vector<Addr> batch;
+	while (numResidentFree > keep) {
+		MChunk* chunk = freeList;
+		freeList = chunk->next;
+		numResidentFree--;
+		batch.push_back(chunk->addr);
+		addMChunk(&releasedList, chunk);
+	}
+	std::sort(batch.begin(), batch.end());
+
+	unsigned i = 0;
+	unsigned num_ranges = 0;
+	while (i < batch.size()) {
+		unsigned char* start = (unsigned char*)batch[i];
+		unsigned char* end = start + chunkSize;
+		for (++i; i < batch.size() && batch[i] == end; ++i) 
+			end += chunkSize;
+
+		(void)madvise(start, end - start, MADV_DONTNEED);
+		num_ranges++;
+	}
+
+	eventShadowRelease(num_ranges, (UInt64)batch.size() * chunkSize);
+	MSG(1, "Released %lu chunks in %u ranges\n", batch.size(), num_ranges);
+}
 
+static void FillFreeList() {
     // Allocate mmapped data.
-	unsigned char* data;
-// Mac OS X doesn't have mmap64... not sure if it's really needed
-#ifdef __MACH__
-    data = (unsigned char*)mmap(NULL, mmapSizeMB * 1024 * 1024, protection,
-								flags, -1, 0);
-#else
-    data = (unsigned char*)mmap64(NULL, mmapSizeMB * 1024 * 1024, protection,
-								flags, -1, 0);
-#endif
+	unsigned char* data = 
+		(unsigned char*)MemMapAnonymous((UInt64)mmapSizeMB * 1024 * 1024);
 	
-	if (data == MAP_FAILED) {
+	if (data == NULL) {
 		perror("mmap");
 		exit(1);
 	} else {
-		assert(freeList == NULL);
+		assert(freeList == NULL && releasedList == NULL);
 	}
 
 	unsigned char* current = data;
 	unsigned cnt = 0;	
 	while ((current + chunkSize) < (data + mmapSizeMB * 1024 * 1024)) {
 		//fprintf(stderr, "current = 0x%llx\n", current);
+		// untouched, so nothing is resident yet
 		MChunk* toAdd = MChunkAlloc(current);		
-		addMChunk(toAdd);	
+		addMChunk(&releasedList, toAdd);	
 		current += chunkSize;
 		cnt++;
 	}
@@ -111,12 +241,19 @@ static void FillFreeList() {
 
 
 Addr MemPoolAlloc() {
-	if (freeList == NULL) {
-		FillFreeList();
+	// prefer chunks whose pages are still resident
+	MChunk** list = &freeList;
+	if (freeList != NULL) {
+		numResidentFree--;
+	}
+	else {
+		if (releasedList == NULL) FillFreeList();
+		list = &releasedList;
+		eventShadowResident(chunkSize);
 	}
-	MChunk* head = freeList;
-	void* ret = freeList->addr;
-	freeList = freeList->next;
+	MChunk* head = *list;
+	void* ret = head->addr;
+	*list = head->next;
 	MChunkFree(head);
 
 	//bzero(ret, chunkSize);
@@ -126,5 +263,21 @@ Addr MemPoolAlloc() {
 
 void MemPoolFree(Addr addr) {
 	MChunk* toAdd = MChunkAlloc(addr);
-	addMChunk(toAdd);
+	addMChunk(&freeList, toAdd);
+	numResidentFree++;
+
+	if (releaseThreshold > 0 && numResidentFree > releaseThreshold)
+		releaseFreeChunks(releaseThreshold / 2);
+}
+
+void MemPoolReleaseFree() {
+	if (kremlin_config.getHugePageMode() == HugePagesHugeTLB) return;
+	if (numResidentFree > 0) releaseFreeChunks(0);
+}
+
+UInt64 MemPoolGetSmallPoolBytes() {
+	unsigned long total = 0;
+	if (poolSmall != NULL)
+		mpool_stats(poolSmall, NULL, NULL, NULL, NULL, &total);
+	return total;
 }
@@ -6,9 +6,45 @@
 
 void MemPoolInit(int, int);
 Addr MemPoolAlloc(void);
+
+/*!
+ * Returns a chunk to the pool. Once the pool holds more free chunks than
+ * the configured release threshold, a batch of them is given back to the
+ * OS (their contents are lost; they read as zero when reused).
+ */
 void MemPoolFree(Addr addr);
 
+/*!
+ * Gives the pages of all free chunks back to the OS, whatever the release
+ * threshold.
+ */
+void MemPoolReleaseFree();
+
 Addr MemPoolAllocSmall(int);
 Addr MemPoolCallocSmall(int, int);
 void MemPoolFreeSmall(Addr addr, int size);
+
+/*!
+ * Returns the number of bytes the small pool has mapped, including its
+ * bookkeeping. The small pool never gives memory back to the OS.
+ */
+UInt64 MemPoolGetSmallPoolBytes();
+
+/*!
+ * Maps zeroed anonymous memory, backed by huge pages if the configured
+ * HugePageMode asks for them and the system has them. Falls back to
+ * normal pages otherwise.
+ *
+ * @param size The number of bytes needed.
+ * @return The memory, or NULL if it couldn't be mapped.
+ */
+Addr MemMapAnonymous(UInt64 size);
+
+/*!
+ * Unmaps memory returned by MemMapAnonymous.
+ *
+ * @param addr The memory to unmap.
+ * @param size The size passed to MemMapAnonymous.
+ */
+void MemUnmapAnonymous(Addr addr, UInt64 size);
 #endif /* MEM_MAP_ALLOCATOR_H */
@@ -1,6 +1,7 @@
 #ifndef _MEMORYSEGMENT_HPP_
 #define _MEMORYSEGMENT_HPP_
 
+#include <cassert>
 #include "ktypes.h"
 
 class LevelTable;
@@ -17,6 +18,13 @@ private:
 	LevelTable* level_tables[NUM_ENTRIES]; //!< The LevelTables associated 
 												// with this MemorySegment
 
+	/*!
+	 * One bit per page, set once any level of the page may have been
+	 * written. Pages whose bit is clear read as all zeros, whether or not
+	 * they have a LevelTable.
+	 */
+	UInt64 written_pages[NUM_ENTRIES / 64];
+
 public:
 	/*!
 	 * Default constructor. Sets all LevelTable* in level_tables to NULL.
@@ -48,13 +56,41 @@ public:
 	 * @pre table is non-NULL.
 	 * @pre index < NUM_ENTRIES
 	 */
-	LevelTable* setLevelTableAtIndex(LevelTable *table, unsigned index) { 
+	void setLevelTableAtIndex(LevelTable *table, unsigned index) { 
 		assert(table != NULL);
 		assert(index < NUM_ENTRIES);
 		level_tables[index] = table;
 	}
 
+	/*!
+	 * Returns whether the page at the specified index may hold timestamps.
+	 *
+	 * @param index The index of the page.
+	 * @pre index < NUM_ENTRIES
+	 */
+	bool isPageWritten(unsigned index) {
+		assert(index < NUM_ENTRIES);
+		return (written_pages[index >> 6] >> (index & 63)) & 1;
+	}
+
+	void setPageWritten(unsigned index) {
+		assert(index < NUM_ENTRIES);
+		written_pages[index >> 6] |= (UInt64)1 << (index & 63);
+	}
+
+	/*!
+	 * Marks the page at the specified index as holding no timestamps.
+	 *
+	 * @pre Neither the page's LevelTable nor the shadow cache hold
+	 * timestamps for it.
+	 */
+	void clearPageWritten(unsigned index) {
+		assert(index < NUM_ENTRIES);
+		written_pages[index >> 6] &= ~((UInt64)1 << (index & 63));
+	}
+
 	static unsigned getNumLevelTables() { return NUM_ENTRIES; }
+	static UInt64 GetPageSize() { return (UInt64)1 << SEGMENT_SHIFT; }
 	static unsigned GetIndex(Addr addr) {
 		return ((UInt64)addr >> SEGMENT_SHIFT) & SEGMENT_MASK;
 	}
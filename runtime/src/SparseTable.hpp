@@ -0,0 +1,134 @@
+#ifndef _SPARSETABLE_HPP_
+#define _SPARSETABLE_HPP_
+
+#include <cassert>
+#include <vector>
+#include "ktypes.h"
+
+/*!
+ * @brief A sparse table that tracks the 4GB memory chunks being used.
+ *
+ * Since the 64-bit address space is very sparsely used by a program, we only
+ * keep entries for the 4GB chunks that have actually been touched. Entries
+ * are found through an open-addressing hash on the upper 32 bits of the
+ * address, with the most recently used entry checked first. The table grows
+ * without limit as new chunks are touched.
+ *
+ * @tparam Segment The type that shadows a single 4GB chunk.
+ */
+template <typename Segment>
+class SparseTable {
+public:
+	class Element {
+	public:
+		UInt32 addrHigh;	//!< upper 32 bits in 64-bit addr
+		Segment* segTable;	//!< NULL until the caller allocates it
+	};
+
+private:
+	static const unsigned INIT_NUM_SLOTS = 64; // must be a power of 2
+
+	std::vector<Element*> slots;	//!< hash index into elements
+	std::vector<Element*> elements;	//!< all live entries, in creation order
+	Element* mru;					//!< most recently used entry
+
+	static unsigned hash(UInt32 addrHigh) {
+		return (UInt32)(addrHigh * 0x9E3779B1U);
+	}
+
+	unsigned getSlotMask() { return slots.size() - 1; }
+
+	void insert(Element* e) {
+		unsigned i = hash(e->addrHigh) & getSlotMask();
+		while (slots[i] != NULL) i = (i + 1) & getSlotMask();
+		slots[i] = e;
+	}
+
+	/*! @brief Doubles the number of hash slots and re-inserts all entries. */
+	void grow() {
+		slots.assign(slots.size() * 2, NULL);
+		for (unsigned i = 0; i < elements.size(); ++i) {
+			insert(elements[i]);
+		}
+	}
+
+public:
+	void init() {
+		slots.assign(INIT_NUM_SLOTS, NULL);
+		elements.clear();
+		mru = NULL;
+	}
+
+	/*!
+	 * @brief Frees all entries.
+	 * @remark Segments are owned by the caller and must be freed before
+	 * calling this.
+	 */
+	void deinit() {
+		for (unsigned i = 0; i < elements.size(); ++i) {
+			delete elements[i];
+		}
+		elements.clear();
+		slots.clear();
+		mru = NULL;
+	}
+
+	unsigned getNumElements() { return elements.size(); }
+
+	Element* getElementAtIndex(unsigned index) {
+		assert(index < elements.size());
+		return elements[index];
+	}
+
+	/*!
+	 * Returns the entry for the 4GB chunk containing addr, or NULL if this
+	 * chunk hasn't been seen before.
+	 *
+	 * @param addr The address whose entry we want.
+	 */
+	Element* findElement(Addr addr) {
+		UInt32 highAddr = (UInt32)((UInt64)addr >> 32);
+		if (mru != NULL && mru->addrHigh == highAddr) return mru;
+
+		unsigned i = hash(highAddr) & getSlotMask();
+		while (slots[i] != NULL) {
+			if (slots[i]->addrHigh == highAddr) return slots[i];
+			i = (i + 1) & getSlotMask();
+		}
+		return NULL;
+	}
+
+	/*!
+	 * Returns the entry for the 4GB chunk containing addr, creating an empty
+	 * one (i.e. with a NULL segTable) if this chunk hasn't been seen before.
+	 *
+	 * @param addr The address whose entry we want.
+	 * @post Returned pointer is non-NULL.
+	 */
+	Element* getElement(Addr addr) {
+		UInt32 highAddr = (UInt32)((UInt64)addr >> 32);
+		if (mru != NULL && mru->addrHigh == highAddr) return mru;
+
+		unsigned i = hash(highAddr) & getSlotMask();
+		while (slots[i] != NULL) {
+			if (slots[i]->addrHigh == highAddr) {
+				mru = slots[i];
+				return mru;
+			}
+			i = (i + 1) & getSlotMask();
+		}
+
+		// not found - create an entry, keeping the load factor below 1/2
+		Element* ret = new Element();
+		ret->addrHigh = highAddr;
+		ret->segTable = NULL;
+		elements.push_back(ret);
+		if (elements.size() * 2 > slots.size()) grow();
+		else slots[i] = ret;
+
+		mru = ret;
+		return ret;
+	}
+};
+
+#endif // _SPARSETABLE_HPP_
@@ -0,0 +1,87 @@
+#include <errno.h>
+#include <fcntl.h> // for posix_fallocate
+#include <stdio.h>
+#include <stdlib.h> // for mkstemp
+#include <string.h> // for strerror
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "SpillArena.hpp"
+
+bool SpillArena::init(const char* dir, UInt64 max_bytes) {
+	std::string path(dir);
+	path += "/kremlin-spill-XXXXXX";
+
+	fd = mkstemp(&path[0]);
+	if (fd < 0) {
+		fprintf(stderr, "[kremlin] WARNING: couldn't create shadow spill file "
+				"in %s: %s\n", dir, strerror(errno));
+		return false;
+	}
+
+	// nobody else needs the file, so it is gone once we close it (or die)
+	unlink(path.c_str());
+
+	long page_size = sysconf(_SC_PAGESIZE);
+	size = max_bytes & ~((UInt64)page_size - 1);
+	void* mapping = MAP_FAILED;
+	errno = EINVAL; // in case size is 0
+	if (size > 0 && ftruncate(fd, size) == 0)
+		mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		fprintf(stderr, "[kremlin] WARNING: couldn't map %llu MB shadow spill "
+				"file: %s\n", (unsigned long long)(size >> 20), strerror(errno));
+		close(fd);
+		fd = -1;
+		size = 0;
+		return false;
+	}
+
+	base = (UInt8*)mapping;
+	used = 0;
+	reserved = 0;
+	full = false;
+
+	MSG(0, "SpillArena: %llu MB in %s\n", size >> 20, dir);
+	return true;
+}
+
+void SpillArena::deinit() {
+	if (base != NULL) munmap(base, size);
+	if (fd >= 0) close(fd);
+	base = NULL;
+	fd = -1;
+	size = used = reserved = 0;
+}
+
+UInt8* SpillArena::alloc(UInt64 chunk_size) {
+	if (base == NULL || full) return NULL;
+
+	if (used + chunk_size > size) {
+		fprintf(stderr, "[kremlin] WARNING: shadow spill file reached its "
+				"%llu MB limit\n", (unsigned long long)(size >> 20));
+		full = true;
+		return NULL;
+	}
+
+	// make sure the disk has room before handing out pages that would
+	// otherwise fault with SIGBUS on the first write
+	while (used + chunk_size > reserved) {
+		UInt64 grow = (size - reserved < GROW_SIZE) ? size - reserved : GROW_SIZE;
+		int err = posix_fallocate(fd, reserved, grow);
+		if (err != 0) {
+			fprintf(stderr, "[kremlin] WARNING: shadow spill file stopped "
+					"growing at %llu MB: %s\n", (unsigned long long)(reserved >> 20),
+					strerror(err));
+			full = true;
+			return NULL;
+		}
+		reserved += grow;
+	}
+
+	UInt8* ret = base + used;
+	used += chunk_size;
+	return ret;
+}
@@ -0,0 +1,63 @@
+#ifndef _SPILLARENA_HPP_
+#define _SPILLARENA_HPP_
+
+#include "ktypes.h"
+
+/*!
+ * @brief Memory backed by a file on local disk instead of RAM.
+ *
+ * The arena is a shared mapping of an (unlinked) temporary file. Pages of
+ * it that haven't been touched for a while are written back to the file
+ * and dropped by the kernel like any other file page, and are faulted back
+ * in from disk on access. This lets cold shadow memory go to disk without
+ * the process needing swap.
+ *
+ * Address space for the whole size limit is reserved up front, but disk
+ * blocks are only reserved as the arena grows, so a full disk makes
+ * alloc fail instead of faulting on a later write. Memory is handed out
+ * in fixed-size chunks that are never returned; callers recycle them.
+ */
+class SpillArena {
+private:
+	static const UInt64 GROW_SIZE = 64 * 1024 * 1024; //!< disk reserved at once
+
+	int fd;
+	UInt8* base;		//!< start of the mapping (NULL if not initialized)
+	UInt64 size;		//!< bytes of address space mapped
+	UInt64 used;		//!< bytes handed out
+	UInt64 reserved;	//!< bytes of the file backed by disk blocks
+	bool full;			//!< alloc has failed once and won't be retried
+
+public:
+	SpillArena() : fd(-1), base(NULL), size(0), used(0), reserved(0),
+					full(false) {}
+
+	/*!
+	 * Creates the backing file in the given directory and maps it.
+	 *
+	 * @param dir The directory for the backing file.
+	 * @param max_bytes The most memory the arena will ever hand out.
+	 * @return false if the file couldn't be created or mapped. A message
+	 * saying why is printed; the arena stays unusable.
+	 */
+	bool init(const char* dir, UInt64 max_bytes);
+
+	/*!
+	 * Unmaps the arena and closes (and thereby deletes) the backing file.
+	 */
+	void deinit();
+
+	/*!
+	 * Returns chunk_size bytes of zeroed file-backed memory, or NULL if the
+	 * arena's size limit is reached or the disk is full.
+	 *
+	 * @param chunk_size The number of bytes needed.
+	 */
+	UInt8* alloc(UInt64 chunk_size);
+
+	bool isFull() { return full; }
+	UInt64 getBytesInUse() { return used; }
+	UInt64 getSizeInBytes() { return size; }
+};
+
+#endif // _SPILLARENA_HPP_
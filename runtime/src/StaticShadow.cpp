@@ -0,0 +1,131 @@
+#include <cassert>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "MShadowStat.h"
+#include "StaticShadow.hpp"
+
+// Defined by the linker (and glibc's crt1) for the main executable: the
+// start of .data and the end of .bss. Weak so that we simply go without
+// this shadow where they don't exist.
+extern "C" char __data_start[] __attribute__((weak));
+extern "C" char _end[] __attribute__((weak));
+
+bool StaticShadow::init(unsigned granularity_shift) {
+	this->granularity_shift = granularity_shift;
+	start = 0;
+	size = 0;
+	num_granules = 0;
+
+	if (__data_start == NULL || _end == NULL
+		|| (UInt64)_end <= (UInt64)__data_start) {
+		MSG(0, "StaticShadow: no data/bss range found\n");
+		return false;
+	}
+
+	UInt64 grain_mask = ((UInt64)1 << granularity_shift) - 1;
+	UInt64 first = (UInt64)__data_start & ~grain_mask;
+	UInt64 last = ((UInt64)_end + grain_mask) & ~grain_mask;
+	if (last - first > MAX_RANGE_SIZE) {
+		MSG(0, "StaticShadow: data/bss range of %llu MB is too big\n",
+			(last - first) >> 20);
+		return false;
+	}
+
+	start = first;
+	size = last - first;
+	num_granules = size >> granularity_shift;
+	MSG(0, "StaticShadow: 0x%llx - 0x%llx (%llu granules)\n",
+		first, last, num_granules);
+	return true;
+}
+
+void StaticShadow::deinit() {
+	for (unsigned i = 0; i < levels.size(); ++i) {
+		if (levels[i] != NULL)
+			munmap(levels[i], sizeof(Entry) * num_granules);
+	}
+	levels.clear();
+	size = 0;
+}
+
+StaticShadow::Entry* StaticShadow::reserveLevel(Index level) {
+	assert(level >= levels.size() || levels[level] == NULL);
+	if (level >= levels.size()) levels.resize(level + 1, NULL);
+
+	void* data = mmap(NULL, sizeof(Entry) * num_granules,
+						PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	levels[level] = (Entry*)data;
+	eventStaticLevelAlloc(sizeof(Entry) * num_granules);
+	return levels[level];
+}
+
+Time* StaticShadow::get(Addr addr, Index size, Version* curr_versions) {
+	assert(contains(addr));
+	assert(curr_versions != NULL);
+
+	if (read_buffer.size() < size) read_buffer.resize(size);
+
+	UInt64 index = ((UInt64)addr - start) >> granularity_shift;
+	for (Index i = 0; i < size; ++i) {
+		Entry* level = (i < levels.size()) ? levels[i] : NULL;
+		if (level != NULL && level[index].version == curr_versions[i])
+			read_buffer[i] = level[index].time;
+		else
+			read_buffer[i] = 0;
+	}
+
+	eventStaticRead();
+	return &read_buffer[0];
+}
+
+void StaticShadow::set(Addr addr, Index size, Version* curr_versions,
+						Time* times) {
+	assert(contains(addr));
+	assert(curr_versions != NULL);
+	assert(times != NULL);
+
+	UInt64 index = ((UInt64)addr - start) >> granularity_shift;
+	for (Index i = 0; i < size; ++i) {
+		Entry* level = (i < levels.size()) ? levels[i] : NULL;
+		if (level == NULL) level = reserveLevel(i);
+		level[index].time = times[i];
+		level[index].version = curr_versions[i];
+	}
+	eventStaticWrite();
+}
+
+void StaticShadow::clear(Addr addr, UInt64 len) {
+	if (!overlaps(addr, len)) return;
+
+	UInt64 first = ((UInt64)addr < start) ? start : (UInt64)addr;
+	UInt64 end = (UInt64)addr + len;
+	if (end > start + size) end = start + size;
+
+	UInt64 first_index = (first - start) >> granularity_shift;
+	UInt64 end_index = (end - start + ((UInt64)1 << granularity_shift) - 1)
+						>> granularity_shift;
+	for (unsigned i = 0; i < levels.size(); ++i) {
+		Entry* level = levels[i];
+		if (level == NULL) continue;
+		for (UInt64 index = first_index; index < end_index; ++index) {
+			level[index].time = 0;
+			level[index].version = 0;
+		}
+	}
+}
+
+UInt64 StaticShadow::getBytesReserved() {
+	UInt64 ret = 0;
+	for (unsigned i = 0; i < levels.size(); ++i) {
+		if (levels[i] != NULL) ret += sizeof(Entry) * num_granules;
+	}
+	return ret;
+}
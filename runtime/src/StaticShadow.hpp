@@ -0,0 +1,106 @@
+#ifndef _STATICSHADOW_HPP_
+#define _STATICSHADOW_HPP_
+
+#include <vector>
+#include "ktypes.h"
+
+/*!
+ * @brief Directly indexed shadow memory for the program's global and static
+ * data.
+ *
+ * The data and bss sections sit in one fixed range that is known when the
+ * program starts, so their timestamps don't need the SparseTable /
+ * MemorySegment / LevelTable walk or the shadow cache: each level gets an
+ * array with one entry per granule of the range, and an access is an
+ * offset and a shift away from its entry. Entries carry the version they
+ * were written in, so stale levels read as zero without any garbage
+ * collection.
+ *
+ * A level's array is reserved with mmap the first time the level is
+ * written; the kernel only backs the parts of it that are touched.
+ */
+class StaticShadow {
+private:
+	class Entry {
+	public:
+		Time time;
+		Version version;
+	};
+
+	//! Data ranges bigger than this are left to the general shadow memory.
+	static const UInt64 MAX_RANGE_SIZE = 256ULL * 1024 * 1024;
+
+	UInt64 start;				//!< first byte of the range (granule aligned)
+	UInt64 size;				//!< bytes in the range, 0 if disabled
+	unsigned granularity_shift;
+	UInt64 num_granules;
+
+	std::vector<Entry*> levels;	//!< NULL for levels never written
+	std::vector<Time> read_buffer;
+
+	Entry* reserveLevel(Index level);
+
+public:
+	StaticShadow() : start(0), size(0), granularity_shift(3),
+						num_granules(0) {}
+
+	/*!
+	 * Finds the program's data and bss sections and prepares to shadow them.
+	 *
+	 * @param granularity_shift log2 of the bytes that share timestamps.
+	 * @return false if the range couldn't be found or is too big; every
+	 * address is then outside this shadow.
+	 */
+	bool init(unsigned granularity_shift);
+
+	/*!
+	 * Unmaps all level arrays.
+	 */
+	void deinit();
+
+	/*!
+	 * Returns whether addr is shadowed here.
+	 */
+	bool contains(Addr addr) {
+		return (UInt64)addr - start < size;
+	}
+
+	/*!
+	 * Returns whether any of [addr, addr+len) is shadowed here.
+	 */
+	bool overlaps(Addr addr, UInt64 len) {
+		return (UInt64)addr < start + size && (UInt64)addr + len > start;
+	}
+
+	/*!
+	 * Returns the timestamps of the granule holding addr at levels up to
+	 * size. Levels written in an older version read as zero.
+	 *
+	 * @pre contains(addr)
+	 * @pre curr_versions is non-NULL.
+	 */
+	Time* get(Addr addr, Index size, Version* curr_versions);
+
+	/*!
+	 * @pre contains(addr)
+	 * @pre curr_versions and times are non-NULL.
+	 */
+	void set(Addr addr, Index size, Version* curr_versions, Time* times);
+
+	/*!
+	 * Drops the timestamps of all granules in [addr, addr+len) that are
+	 * shadowed here.
+	 */
+	void clear(Addr addr, UInt64 len);
+
+	/*!
+	 * Returns the bytes reserved for level arrays, i.e. the most RAM they
+	 * can use.
+	 */
+	UInt64 getBytesReserved();
+
+	Addr getStart() { return (Addr)start; }
+	UInt64 getSize() { return size; }
+};
+
+#endif // _STATICSHADOW_HPP_
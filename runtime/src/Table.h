@@ -6,6 +6,7 @@
 #include "MemMapAllocator.h"
 
 #include <cstdlib> // for calloc
+#include <cstring> // for memmove
 
 class Table {
 private:
@@ -31,6 +32,14 @@ public:
 	inline int	getRow() { return this->row; }
 	inline int	getCol() { return this->col; }
 
+	/*!
+	 * Widens every row to new_col columns, keeping the existing values of
+	 * each row. The new columns are zeroed.
+	 *
+	 * @pre new_col is at least the current number of columns.
+	 */
+	inline void growColumns(int new_col);
+
 	inline Time* getElementAddr(int row, int col);
 	inline Time getValue(int row, int col);
 	inline void setValue(Time time, int row, int col);
@@ -71,6 +80,26 @@ Time* Table::getElementAddr(int row, int col) {
 }
 
 
+void Table::growColumns(int new_col) {
+	assert(new_col >= this->col);
+	if (new_col == this->col) return;
+
+	MSG(3, "TableGrowColumns: this = 0x%llx col = %d -> %d\n", this, this->col, new_col);
+	Time* new_array = (Time*) realloc(this->array, (size_t)this->row * new_col * sizeof(Time));
+	assert(new_array != NULL);
+
+	// Move rows back to front so no row is overwritten before it is moved.
+	for (int r = this->row - 1; r >= 0; --r) {
+		memmove(&new_array[r * new_col], &new_array[r * this->col], 
+				this->col * sizeof(Time));
+		memset(&new_array[r * new_col + this->col], 0, 
+				(new_col - this->col) * sizeof(Time));
+	}
+
+	this->array = new_array;
+	this->col = new_col;
+}
+
 Time Table::getValue(int row, int col) {
 	assert(row < this->row);
 	assert(col < this->col);
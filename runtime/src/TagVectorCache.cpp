@@ -1,6 +1,10 @@
 #include <cassert>
+#include <stdlib.h> // for calloc
+#include <string.h> // for memcpy
 #include "config.h"
-#include "Table.h"
+#include "debug.h"
+#include "MemMapAllocator.h"
+#include "TimeSlab.hpp"
 #include "TagVectorCache.h"
 #include "TagVectorCacheLine.h"
 
@@ -18,51 +22,294 @@ static inline int getFirstOnePosition(int input) {
 }
 
 TagVectorCacheLine* TagVectorCache::getTag(int index) {
-	assert(index < getLineCount());
+	assert(index < getTotalLineCount());
 	return &tagTable[index];
 }
 
 Time* TagVectorCache::getData(int index, int offset) {
-	return valueTable->getElementAddr(index*2 + offset, 0);
+	return getTag(index)->data[offset];
+}
+
+UInt64 TagVectorCache::getTagBytes() {
+	UInt64 ret = sizeof(TagVectorCacheLine) * getTotalLineCount();
+	ret += sizeof(EvictedTag) * (evict_history_mask + 1);
+	if (plru_bits != NULL) ret += sizeof(UInt64) * set_count;
+	return ret;
 }
 
 void TagVectorCache::configure(int new_size_in_mb, int new_depth) {
 	// TODO: make sure we haven't configured before
-	const int new_line_size = 8;
-	int new_line_count = new_size_in_mb * 1024 * 1024 / new_line_size;
+	UInt64 size_in_bytes = (UInt64)new_size_in_mb * 1024 * 1024;
+
+	// tags (and the eviction history that goes with them) get half the
+	// budget, rounded down to a power of 2 lines
+	UInt64 tag_line_size = sizeof(TagVectorCacheLine) + sizeof(EvictedTag) / 4;
+	UInt64 max_line_count = size_in_bytes / 2 / tag_line_size;
+	int new_line_count = 1;
+	while ((UInt64)new_line_count * 2 <= max_line_count) new_line_count *= 2;
+
 	this->size_in_mb = new_size_in_mb;
 	this->line_count = new_line_count;
 	this->line_shift = getFirstOnePosition(new_line_count);
 	this->depth = new_depth;
 
+	this->num_ways = kremlin_config.getShadowMemCacheWays();
+	if (this->num_ways > new_line_count) this->num_ways = new_line_count;
+	this->set_count = new_line_count / this->num_ways;
+	this->set_shift = getFirstOnePosition(this->set_count);
+	this->use_plru = 
+		(kremlin_config.getShadowMemCacheReplacement() == ShadowCachePLRU);
+	this->use_clock = 0;
+	this->victim_count = kremlin_config.getShadowMemCacheVictimEntries();
+	this->next_victim = 0;
+	this->reclaim_hand = 0;
+
 	MSG(0, "TagVectorCache: size: %d MB, lineNum %d, lineShift %d, depth %d\n", 
 		new_size_in_mb, new_line_count, this->line_shift, this->depth);
+	MSG(0, "TagVectorCache: ways %d, sets %d, replacement %s, victims %d\n", 
+		this->num_ways, this->set_count, this->use_plru ? "PLRU" : "LRU", 
+		this->victim_count);
 
-	tagTable = (TagVectorCacheLine*)MemPoolCallocSmall(new_line_count, sizeof(TagVectorCacheLine)); // 64bit granularity
-	valueTable = new Table(new_line_count * 2, this->depth);  // 32bit granularity
+	int total_line_count = getTotalLineCount();
+	tagTable = (TagVectorCacheLine*)MemPoolCallocSmall(total_line_count, sizeof(TagVectorCacheLine)); // 64bit granularity
 
-	MSG(TV_CACHE_DEBUG_LVL, "MShadowCacheInit: value Table created row %d col %d\n", 
-		new_line_count, kremlin_config.getNumProfiledLevels());
+	this->plru_bits = NULL;
+	if (this->use_plru && this->num_ways > 1)
+		this->plru_bits = (UInt64*)calloc(this->set_count, sizeof(UInt64));
+
+	int history_size = new_line_count / 4;
+	if (history_size < 1) history_size = 1;
+	this->evict_history_mask = history_size - 1;
+	this->evict_history = (EvictedTag*)calloc(history_size, sizeof(EvictedTag));
+	this->num_fills = 0;
+
+	// whatever is left holds the timestamps
+	assert(getTagBytes() < size_in_bytes);
+	valueSlab = new TimeSlab();
+	valueSlab->init(size_in_bytes - getTagBytes());
+
+	MSG(TV_CACHE_DEBUG_LVL, "MShadowCacheInit: tags %llu bytes, slab %llu bytes\n", 
+		getTagBytes(), valueSlab->getSizeInBytes());
 }
 
-int TagVectorCache::getLineIndex(Addr addr) {
-#if 0
-	int nShift = 3; 	// 8 byte 
-	int ret = (((UInt64)addr) >> nShift) & lineMask;
-	assert(ret >= 0 && ret < lineNum);
-#endif
+void TagVectorCache::setDepth(int new_depth) {
+	assert(new_depth >= this->depth);
+	MSG(0, "TagVectorCache: depth %d -> %d\n", this->depth, new_depth);
+	this->depth = new_depth;
+}
+
+bool TagVectorCache::reserveData(int index, int offset, int size) {
+	TagVectorCacheLine* line = getTag(index);
+	if ((int)line->capacity[offset] >= size) return true;
+
+	UInt32 new_capacity = 0;
+	Time* new_data = valueSlab->alloc(size, &new_capacity);
+	if (new_data == NULL) return false;
+
+	UInt32 old_capacity = line->capacity[offset];
+	if (line->data[offset] != NULL) {
+		memcpy(new_data, line->data[offset], sizeof(Time) * old_capacity);
+		valueSlab->free(line->data[offset], old_capacity);
+	}
+	memset(&new_data[old_capacity], 0, 
+			sizeof(Time) * (new_capacity - old_capacity));
+
+	line->data[offset] = new_data;
+	line->capacity[offset] = new_capacity;
+	return true;
+}
+
+int TagVectorCache::getReclaimIndex(int keep_index) {
+	int total = getTotalLineCount();
+	for (int i = 0; i < total; ++i) {
+		int index = reclaim_hand;
+		reclaim_hand = (reclaim_hand + 1) % total;
+		if (index != keep_index && tagTable[index].data[0] != NULL)
+			return index;
+	}
+	return -1;
+}
+
+void TagVectorCache::clearLine(int index) {
+	TagVectorCacheLine* line = getTag(index);
+	for (int offset = 0; offset < 2; ++offset) {
+		if (line->data[offset] != NULL)
+			valueSlab->free(line->data[offset], line->capacity[offset]);
+	}
+	memset(line, 0, sizeof(TagVectorCacheLine));
+}
+
+void TagVectorCache::findLinesInRange(Addr start, Addr end, std::vector<int>* lines) {
+	UInt64 num_words = ((UInt64)end - (UInt64)start) >> 3;
+	if (num_words > (UInt64)getTotalLineCount()) {
+		for (int i = 0; i < getTotalLineCount(); ++i) {
+			Addr tag = tagTable[i].tag;
+			if (tag != 0x0 && tag >= start && tag < end) lines->push_back(i);
+		}
+		return;
+	}
+
+	for (char* addr = (char*)start; addr < (char*)end; addr += 8) {
+		int base = getLineIndex(addr);
+		for (int i = base; i < base + num_ways; ++i) {
+			if (tagTable[i].isHit(addr)) lines->push_back(i);
+		}
+		for (int i = getFirstVictimIndex(); i < getTotalLineCount(); ++i) {
+			if (tagTable[i].isHit(addr)) lines->push_back(i);
+		}
+	}
+}
+
+void TagVectorCache::release() {
+	MemPoolFreeSmall(tagTable, sizeof(TagVectorCacheLine) * getTotalLineCount());
+	tagTable = NULL;
+	valueSlab->deinit();
+	delete valueSlab;
+	valueSlab = NULL;
+
+	free(plru_bits);
+	plru_bits = NULL;
+	free(evict_history);
+	evict_history = NULL;
+}
+
+int TagVectorCache::getSetIndex(Addr addr) {
 	int nShift = 3;	
-	int lineMask = getLineMask();
-	int lineShift = getLineShift();
-	int val0 = (((UInt64)addr) >> nShift) & lineMask;
-	int val1 = (((UInt64)addr) >> (nShift + lineShift)) & lineMask;
+	int setMask = set_count - 1;
+	int val0 = (((UInt64)addr) >> nShift) & setMask;
+	int val1 = (((UInt64)addr) >> (nShift + set_shift)) & setMask;
 	return val0 ^ val1;
 }
 
+int TagVectorCache::getLineIndex(Addr addr) {
+	return getSetIndex(addr) * num_ways;
+}
+
+int TagVectorCache::getReplacementWay(int set) {
+	int base = set * num_ways;
+	for (int i = 0; i < num_ways; ++i) {
+		if (tagTable[base + i].tag == 0x0) return i;
+	}
 
+	if (num_ways == 1) return 0;
 
-void TagVectorCache::lookupRead(Addr addr, int type, int* pIndex, TagVectorCacheLine** pLine, int* pOffset, Time** pTArray) {
-	int index = this->getLineIndex(addr);
+	if (use_plru) {
+		// follow the tree bits towards the pseudo-least recently used way
+		UInt64 bits = plru_bits[set];
+		int node = 1;
+		int way = 0;
+		for (int i = 0; (1 << i) < num_ways; ++i) {
+			int dir = (bits >> node) & 0x1;
+			way = (way << 1) | dir;
+			node = (node << 1) | dir;
+		}
+		return way;
+	}
+
+	int lru_way = 0;
+	for (int i = 1; i < num_ways; ++i) {
+		if (tagTable[base + i].last_use < tagTable[base + lru_way].last_use)
+			lru_way = i;
+	}
+	return lru_way;
+}
+
+int TagVectorCache::getFillIndex(Addr addr) {
+	int set = getSetIndex(addr);
+	return set * num_ways + getReplacementWay(set);
+}
+
+int TagVectorCache::findLine(Addr addr, bool* pVictimHit) {
+	*pVictimHit = false;
+
+	int base = getLineIndex(addr);
+	for (int i = base; i < base + num_ways; ++i) {
+		if (tagTable[i].isHit(addr)) return i;
+	}
+
+	for (int i = getFirstVictimIndex(); i < getTotalLineCount(); ++i) {
+		if (tagTable[i].isHit(addr)) {
+			// bring it back into its set, displacing the way we'd replace
+			int index = getFillIndex(addr);
+			swapLines(index, i);
+			*pVictimHit = true;
+			return index;
+		}
+	}
+
+	return -1;
+}
+
+int TagVectorCache::getVictimSlot() {
+	if (victim_count == 0) return -1;
+
+	for (int i = getFirstVictimIndex(); i < getTotalLineCount(); ++i) {
+		if (tagTable[i].tag == 0x0) return i;
+	}
+
+	int ret = getFirstVictimIndex() + next_victim;
+	next_victim = (next_victim + 1) % victim_count;
+	return ret;
+}
+
+void TagVectorCache::swapLines(int index0, int index1) {
+	// data blocks belong to the line, so they move with it
+	TagVectorCacheLine temp = tagTable[index0];
+	tagTable[index0] = tagTable[index1];
+	tagTable[index1] = temp;
+}
+
+void TagVectorCache::moveLine(int from_index, int to_index) {
+	clearLine(to_index);
+	tagTable[to_index] = tagTable[from_index];
+	memset(&tagTable[from_index], 0, sizeof(TagVectorCacheLine));
+}
+
+void TagVectorCache::touchLine(int index) {
+	if (num_ways == 1 || index >= line_count) return;
+
+	if (!use_plru) {
+		tagTable[index].last_use = ++use_clock;
+		return;
+	}
+
+	// point every node on the path to this way away from it
+	int set = index / num_ways;
+	int way = index % num_ways;
+	UInt64 bits = plru_bits[set];
+	int node = 1;
+	int levels = getFirstOnePosition(num_ways);
+	for (int i = levels - 1; i >= 0; --i) {
+		int dir = (way >> i) & 0x1;
+		if (dir == 0) bits |= (1ULL << node);
+		else bits &= ~(1ULL << node);
+		node = (node << 1) | dir;
+	}
+	plru_bits[set] = bits;
+}
+
+void TagVectorCache::recordEviction(int index) {
+	Addr tag = tagTable[index].tag;
+	if (tag == 0x0) return;
+
+	int slot = ((UInt64)tag >> 3) & evict_history_mask;
+	evict_history[slot].tag = tag;
+	evict_history[slot].fill = num_fills;
+}
+
+bool TagVectorCache::isConflictMiss(Addr addr) {
+	num_fills++;
+
+	int slot = ((UInt64)addr >> 3) & evict_history_mask;
+	EvictedTag* entry = &evict_history[slot];
+	if (entry->tag == 0x0 
+		|| (((UInt64)entry->tag ^ (UInt64)addr) >> 3) != 0)
+		return false;
+
+	return num_fills - entry->fill <= (UInt64)getTotalLineCount();
+}
+
+void TagVectorCache::lookupRead(Addr addr, int type, int index, TagVectorCacheLine** pLine, int* pOffset, Time** pTArray) {
 	int offset = 0; 
 	TagVectorCacheLine* line = this->getTag(index);
 	if (line->type == TimeTable::TYPE_32BIT && type == TimeTable::TYPE_64BIT) {
@@ -70,7 +317,10 @@ void TagVectorCache::lookupRead(Addr addr, int type, int* pIndex, TagVectorCache
 		Time* option0 = this->getData(index, 0);
 		Time* option1 = this->getData(index, 1);
 		// check the first item only
-		offset = (*option0 > *option1) ? 0 : 1;
+		if (option0 == NULL || option1 == NULL)
+			offset = (option0 != NULL) ? 0 : 1;
+		else
+			offset = (*option0 > *option1) ? 0 : 1;
 
 	} else {
 		offset = ((UInt64)addr >> 2) & 0x1;
@@ -78,14 +328,12 @@ void TagVectorCache::lookupRead(Addr addr, int type, int* pIndex, TagVectorCache
 
 	assert(index < this->getLineCount());
 
-	*pIndex = index;
 	*pTArray = this->getData(index, offset);
 	*pOffset = offset;
 	*pLine = line;
 }
 
-void TagVectorCache::lookupWrite(Addr addr, int type, int *pIndex, TagVectorCacheLine** pLine, int* pOffset, Time** pTArray) {
-	int index = this->getLineIndex(addr);
+void TagVectorCache::lookupWrite(Addr addr, int type, int index, TagVectorCacheLine** pLine, int* pOffset, Time** pTArray) {
 	int offset = ((UInt64)addr >> 2) & 0x1;
 	assert(index < this->getLineCount());
 	TagVectorCacheLine* line = this->getTag(index);
@@ -96,17 +344,20 @@ void TagVectorCache::lookupWrite(Addr addr, int type, int *pIndex, TagVectorCach
 		line->version[1] = line->version[0];
 		line->lastSize[1] = line->lastSize[1];
 
+		// SkaduCache reserved room in offset 1 before calling us
 		Time* option0 = this->getData(index, 0);
 		Time* option1 = this->getData(index, 1);
-		memcpy(option1, option0, sizeof(Time) * line->lastSize[0]);
+		assert(line->lastSize[0] == 0 
+				|| (int)line->capacity[1] >= line->lastSize[0]);
+		if (line->lastSize[0] > 0)
+			memcpy(option1, option0, sizeof(Time) * line->lastSize[0]);
+		line->dirty[1] = line->dirty[0];
 	}
 
 
 	//fprintf(stderr, "index = %d, tableSize = %d\n", tTableIndex, this->valueTable->getRow());
-	*pIndex = index;
 	*pTArray = this->getData(index, offset);
 	*pLine = line;
 	*pOffset = offset;
 	return;
 }
-
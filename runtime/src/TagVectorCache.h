@@ -1,12 +1,25 @@
 #ifndef TAG_VECTOR_CACHE_H
 #define TAG_VECTOR_CACHE_H
 
+#include <vector>
 #include "ktypes.h"
 
 class TagVectorCacheLine;
-class Table;
+class TimeSlab;
 
-/*! \brief Cache for tag vectors */ 
+/*!
+ * \brief Cache for tag vectors
+ *
+ * Lines are grouped into sets of num_ways consecutive lines; with one way
+ * the cache is direct-mapped. Lines beyond the last set form a small fully
+ * associative victim buffer that holds lines recently displaced from their
+ * set.
+ *
+ * The configured size bounds all memory used by the cache. Half of it goes
+ * to tags and the rest to a TimeSlab from which each line allocates only
+ * as many levels as it holds. When the slab is full, other lines have to
+ * give up their data (see getReclaimIndex).
+ */
 class TagVectorCache {
 private:
 	int  size_in_mb;
@@ -14,23 +27,154 @@ private:
 	int  line_shift;
 	int  depth;
 
+	int  num_ways;		//!< lines per set (power of 2)
+	int  set_count;		//!< number of sets
+	int  set_shift;		//!< log2(set_count)
+	bool use_plru;		//!< tree pseudo-LRU instead of true LRU
+	UInt64 use_clock;	//!< advanced on every access, for true LRU
+	UInt64* plru_bits;	//!< one pseudo-LRU tree per set
+
+	int  victim_count;	//!< number of lines in the victim buffer
+	int  next_victim;	//!< next victim buffer slot to replace
+	int  reclaim_hand;	//!< next line to consider in getReclaimIndex
+
+	/*!
+	 * \brief Recently evicted tags, used to classify misses.
+	 *
+	 * A miss on a tag that was evicted fewer than line_count fills ago would
+	 * likely have hit in a fully associative cache of the same size, so it
+	 * is counted as a conflict miss rather than a capacity miss.
+	 */
+	class EvictedTag {
+	public:
+		Addr tag;
+		UInt64 fill;	//!< value of num_fills when tag was evicted
+	};
+	EvictedTag* evict_history;
+	int  evict_history_mask;
+	UInt64 num_fills;
+
+	int getSetIndex(Addr addr);
+	int getReplacementWay(int set);
+	int getFirstVictimIndex() { return line_count; }
+	void swapLines(int index0, int index1);
+
 public:
 	TagVectorCacheLine* tagTable;
-	Table* valueTable;
+	TimeSlab* valueSlab;
 
 	int getSize() { return size_in_mb; }
 	int getLineCount() { return line_count; }
 	int getLineMask() { return line_count - 1; }
 	int getDepth() { return depth; }
 	int getLineShift() { return line_shift; }
+	int getNumWays() { return num_ways; }
+	int getVictimCount() { return victim_count; }
+
+	/*!
+	 * Returns the number of lines, including those in the victim buffer.
+	 */
+	int getTotalLineCount() { return line_count + victim_count; }
 
 	TagVectorCacheLine* getTag(int index);
 	Time* getData(int index, int offset);
 	int getLineIndex(Addr addr);
 
 	void configure(int size_in_mb, int depth);
-	void lookupRead(Addr addr, int type, int* pIndex, TagVectorCacheLine** pLine, int* pOffset, Time** pTArray);
-	void lookupWrite(Addr addr, int type, int *pIndex, TagVectorCacheLine** pLine, int* pOffset, Time** pTArray);
+
+	/*!
+	 * Grows the number of levels the cache handles. Lines are sized on
+	 * demand, so nothing is reallocated.
+	 *
+	 * @pre new_depth is at least the current depth.
+	 */
+	void setDepth(int new_depth);
+
+	/*!
+	 * Makes sure the data of a line offset has room for size levels,
+	 * keeping its current contents. Newly added levels are zeroed.
+	 *
+	 * @return false if the slab has no room; nothing is changed then.
+	 */
+	bool reserveData(int index, int offset, int size);
+
+	/*!
+	 * Returns the index of a line other than keep_index that holds data,
+	 * cycling through all lines, or -1 if there is none. The caller should
+	 * write the line back and empty it with clearLine to free slab space.
+	 */
+	int getReclaimIndex(int keep_index);
+
+	/*!
+	 * Empties a line and returns its data to the slab.
+	 */
+	void clearLine(int index);
+
+	/*!
+	 * Appends the index of every line whose tag is in [start, end) to lines.
+	 * Small ranges are probed word by word; large ones scan the whole tag
+	 * table instead.
+	 */
+	void findLinesInRange(Addr start, Addr end, std::vector<int>* lines);
+
+	/*!
+	 * Returns the number of bytes used by tags and cache bookkeeping.
+	 */
+	UInt64 getTagBytes();
+
+	/*!
+	 * Frees the tag and value tables allocated by configure.
+	 */
+	void release();
+
+	/*!
+	 * Finds the line holding addr. A line found in the victim buffer is
+	 * swapped back into its set first.
+	 *
+	 * @param addr The address to look for.
+	 * @param[out] pVictimHit Set to true if the line came from the victim
+	 * buffer.
+	 * @return Index of the line holding addr, or -1 if it isn't cached.
+	 */
+	int findLine(Addr addr, bool* pVictimHit);
+
+	/*!
+	 * Returns the index of the line in addr's set that a miss on addr
+	 * should fill: an empty way if there is one, otherwise the least
+	 * recently used way.
+	 */
+	int getFillIndex(Addr addr);
+
+	/*!
+	 * Returns the victim buffer slot to use for the next displaced line, or
+	 * -1 if there is no victim buffer.
+	 */
+	int getVictimSlot();
+
+	/*!
+	 * Copies the tag and data of a line into another line and empties the
+	 * source line.
+	 */
+	void moveLine(int from_index, int to_index);
+
+	/*!
+	 * Marks a line as the most recently used in its set.
+	 */
+	void touchLine(int index);
+
+	/*!
+	 * Records that a line's tag is leaving the cache.
+	 */
+	void recordEviction(int index);
+
+	/*!
+	 * Returns true if a miss on addr is a conflict miss (see EvictedTag).
+	 * Should be called once per fill.
+	 */
+	bool isConflictMiss(Addr addr);
+
+	void lookupRead(Addr addr, int type, int index, TagVectorCacheLine** pLine, int* pOffset, Time** pTArray);
+	void lookupWrite(Addr addr, int type, int index, TagVectorCacheLine** pLine, int* pOffset, Time** pTArray);
 };
 
 #endif
@@ -1,11 +1,9 @@
 #include "debug.h"
 #include "TagVectorCacheLine.h"
+#include "LevelVersions.h"
 
 static const int TV_CACHE_LINE_DEBUG_LVL = 0;
 
-// XXX: not sure this should be a global function (in MShadowCache.cpp)
-extern int getStartInvalidLevel(Version lastVer, Version* vArray, Index size);
-
 bool TagVectorCacheLine::isHit(Addr addr) {
 	// XXX: tag printed twice??? (-sat)
 	MSG(3, "isHit addr = 0x%llx, tag = 0x%llx, entry tag = 0x%llx\n",
@@ -15,7 +13,7 @@ bool TagVectorCacheLine::isHit(Addr addr) {
 }
 
 void TagVectorCacheLine::validateTag(Time* destAddr, Version* vArray, Index size) {
-	int firstInvalid = getStartInvalidLevel(this->version[0], vArray, size);
+	int firstInvalid = getStartInvalidLevel(this->version[0], this->lastSize[0], vArray, size);
 
 	MSG(TV_CACHE_LINE_DEBUG_LVL, "\t\tTVCacheValidateTag: invalid from level %d\n", firstInvalid);
 	if (size > firstInvalid)
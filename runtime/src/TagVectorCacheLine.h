@@ -10,6 +10,10 @@ public:
 	Version version[2];
 	int lastSize[2];	// required to know the region depth at eviction
 	TimeTable::TableType type;
+	UInt64 last_use;	// for LRU replacement in set-associative caches
+	bool dirty[2];		// set when an offset is written, cleared on write-back
+	Time* data[2];		// timestamps of each offset, allocated from a TimeSlab
+	UInt32 capacity[2];	// number of Times in each data block
 
 	Version getVersion(int offset) { return this->version[offset]; }
 
@@ -23,6 +27,14 @@ public:
 		this->lastSize[offset] = size;
 	}
 
+	bool isDirty(int offset) { return this->dirty[offset]; }
+	void setDirty(int offset) { this->dirty[offset] = true; }
+
+	void clearDirty() {
+		this->dirty[0] = false;
+		this->dirty[1] = false;
+	}
+
 	void print() {
 		fprintf(stderr, "addr 0x%p, ver [%llu, %llu], lastSize [%d, %d], type %d\n",
 			this->tag, this->version[0], this->version[1], this->lastSize[0], this->lastSize[1], this->type);
@@ -0,0 +1,106 @@
+#include <cassert>
+#include <stdlib.h> // for calloc
+#include "debug.h"
+#include "MemMapAllocator.h"
+#include "TimeSlab.hpp"
+
+unsigned TimeSlab::GetOrder(UInt64 num_times) {
+	unsigned order = MIN_ORDER;
+	while ((1ULL << order) < num_times) ++order;
+	return order;
+}
+
+void TimeSlab::pushFree(UInt64 unit, unsigned order) {
+	Time* block = &base[unit];
+	block[0] = free_heads[order];
+	block[1] = NIL;
+	if (free_heads[order] != NIL) base[free_heads[order] + 1] = unit;
+	free_heads[order] = unit;
+	free_orders[unit >> MIN_ORDER] = order + 1;
+}
+
+void TimeSlab::removeFree(UInt64 unit, unsigned order) {
+	Time* block = &base[unit];
+	UInt64 next = block[0];
+	UInt64 prev = block[1];
+	if (prev != NIL) base[prev] = next;
+	else free_heads[order] = next;
+	if (next != NIL) base[next + 1] = prev;
+	free_orders[unit >> MIN_ORDER] = 0;
+}
+
+void TimeSlab::init(UInt64 max_bytes) {
+	// each pair of Times costs 16 bytes of slab plus 1 byte of free_orders
+	UInt64 max_units = max_bytes * 2 / (2 * sizeof(Time) + 1);
+	assert(max_units >= (1ULL << MIN_ORDER));
+
+	// the slab is a whole number of top-level blocks
+	max_order = MIN_ORDER;
+	while (max_order < MAX_ORDER && (2ULL << max_order) <= max_units) 
+		++max_order;
+	num_units = max_units & ~((1ULL << max_order) - 1);
+
+	// mapped rather than malloced so it can be backed by huge pages
+	base = (Time*)MemMapAnonymous(getSizeInBytes());
+	free_orders = (UInt8*)calloc(num_units >> MIN_ORDER, sizeof(UInt8));
+	assert(base != NULL && free_orders != NULL);
+
+	for (unsigned i = 0; i < 64; ++i) free_heads[i] = NIL;
+	for (UInt64 unit = 0; unit < num_units; unit += (1ULL << max_order)) {
+		pushFree(unit, max_order);
+	}
+	units_in_use = 0;
+
+	MSG(0, "TimeSlab: %llu Times (%llu bytes), max order %u\n",
+		num_units, getSizeInBytes(), max_order);
+}
+
+void TimeSlab::deinit() {
+	MemUnmapAnonymous(base, getSizeInBytes());
+	base = NULL;
+	::free(free_orders);
+	free_orders = NULL;
+}
+
+Time* TimeSlab::alloc(UInt64 num_times, UInt32* capacity) {
+	assert(capacity != NULL);
+	unsigned order = GetOrder(num_times);
+	if (order > max_order) return NULL;
+
+	// find the smallest free block that is big enough
+	unsigned found = order;
+	while (found <= max_order && free_heads[found] == NIL) ++found;
+	if (found > max_order) return NULL;
+
+	UInt64 unit = free_heads[found];
+	removeFree(unit, found);
+
+	// split it down to size, freeing the upper halves
+	while (found > order) {
+		--found;
+		pushFree(unit + (1ULL << found), found);
+	}
+
+	units_in_use += (1ULL << order);
+	*capacity = 1U << order;
+	return &base[unit];
+}
+
+void TimeSlab::free(Time* block, UInt32 capacity) {
+	assert(block >= base && block < base + num_units);
+	unsigned order = GetOrder(capacity);
+	assert((1U << order) == capacity);
+
+	units_in_use -= capacity;
+
+	// merge with the buddy for as long as it is free
+	UInt64 unit = block - base;
+	while (order < max_order) {
+		UInt64 buddy = unit ^ (1ULL << order);
+		if (free_orders[buddy >> MIN_ORDER] != order + 1) break;
+		removeFree(buddy, order);
+		if (buddy < unit) unit = buddy;
+		++order;
+	}
+	pushFree(unit, order);
+}
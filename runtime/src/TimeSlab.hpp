@@ -0,0 +1,64 @@
+#ifndef _TIMESLAB_HPP_
+#define _TIMESLAB_HPP_
+
+#include "ktypes.h"
+
+/*!
+ * @brief A fixed-size slab of Time, handed out in variable-length blocks.
+ *
+ * Blocks are managed with a binary buddy system: every block holds a power
+ * of two number of Times, larger free blocks are split to satisfy smaller
+ * requests and freed blocks are merged with their buddy whenever possible.
+ * The slab is a whole number of top-level blocks and never grows, so
+ * allocation fails (returns NULL) when no free block is big enough.
+ */
+class TimeSlab {
+private:
+	static const unsigned MIN_ORDER = 1; // free blocks hold two links
+	static const unsigned MAX_ORDER = 16; // largest block is 64K Times
+	static const UInt64 NIL = ~0ULL;
+
+	Time* base;				//!< start of the slab
+	UInt64 num_units;		//!< number of Times in the slab
+	unsigned max_order;		//!< order of the largest blocks
+	UInt64 free_heads[64];	//!< first free block of each order (or NIL)
+	UInt8* free_orders;		//!< order+1 of free block starting at each pair
+	UInt64 units_in_use;	//!< number of Times handed out
+
+	static unsigned GetOrder(UInt64 num_times);
+
+	void pushFree(UInt64 unit, unsigned order);
+	void removeFree(UInt64 unit, unsigned order);
+
+public:
+	/*!
+	 * Creates a slab that, including its bookkeeping, uses at most the
+	 * given number of bytes.
+	 *
+	 * @param max_bytes The memory budget for the slab.
+	 */
+	void init(UInt64 max_bytes);
+	void deinit();
+
+	/*!
+	 * Allocates a block with room for at least num_times Times.
+	 *
+	 * @param num_times The number of Times needed.
+	 * @param[out] capacity The number of Times in the returned block.
+	 * @return The block, or NULL if no free block is large enough.
+	 */
+	Time* alloc(UInt64 num_times, UInt32* capacity);
+
+	/*!
+	 * Returns a block to the slab.
+	 *
+	 * @param block A block returned by alloc.
+	 * @param capacity The capacity returned by alloc for this block.
+	 */
+	void free(Time* block, UInt32 capacity);
+
+	UInt64 getSizeInBytes() { return num_units * sizeof(Time); }
+	UInt64 getBytesInUse() { return units_in_use * sizeof(Time); }
+};
+
+#endif // _TIMESLAB_HPP_
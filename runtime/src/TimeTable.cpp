@@ -38,8 +38,10 @@ TimeTable::TimeTable(TimeTable::TableType size_type) : type(size_type) {
 TimeTable::~TimeTable() {
 	eventTimeTableFree(this->type, this->size);
 
-	MemPoolFree(this->array);
-	this->array = NULL;
+	if (this->array != NULL) {
+		MemPoolFree(this->array);
+		this->array = NULL;
+	}
 }
 
 // TODO: Replace with a function that modifies this TimeTable rather than
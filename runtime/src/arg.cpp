@@ -44,6 +44,7 @@ void parseKremlinOptions(KremlinConfiguration &config,
 
 	int disable_rs = 0;
 	int enable_sm_compress = 0;
+	int enable_sm_compress_async = 0;
 #ifdef KREMLIN_DEBUG
 	int enable_idbg;
 #endif
@@ -54,6 +55,7 @@ void parseKremlinOptions(KremlinConfiguration &config,
 		{
 			{"kremlin-disable-rsummary", no_argument, &disable_rs, 1},
 			{"kremlin-compress-shadow-mem", no_argument, &enable_sm_compress, 1},
+			{"kremlin-compress-shadow-mem-async", no_argument, &enable_sm_compress_async, 1},
 #ifdef KREMLIN_DEBUG
 			{"kremlin-idbg", no_argument, &enable_idbg, 1},
 #endif
@@ -66,6 +68,18 @@ void parseKremlinOptions(KremlinConfiguration &config,
 			{"kremlin-cbuffer-size", required_argument, NULL, 'f'},
 			{"kremlin-min-level", required_argument, NULL, 'g'},
 			{"kremlin-max-level", required_argument, NULL, 'h'},
+			{"kremlin-shadow-mem-layout", required_argument, NULL, 'i'},
+			{"kremlin-shadow-mem-cache-ways", required_argument, NULL, 'j'},
+			{"kremlin-shadow-mem-cache-replacement", required_argument, NULL, 'k'},
+			{"kremlin-shadow-mem-victim-entries", required_argument, NULL, 'l'},
+			{"kremlin-shadow-codec", required_argument, NULL, 'm'},
+			{"kremlin-shadow-spill-dir", required_argument, NULL, 'n'},
+			{"kremlin-shadow-spill-limit", required_argument, NULL, 'o'},
+			{"kremlin-huge-pages", required_argument, NULL, 'p'},
+			{"kremlin-shadow-release-threshold", required_argument, NULL, 'q'},
+			{"kremlin-mem-limit", required_argument, NULL, 'r'},
+			{"kremlin-shadow-granularity", required_argument, NULL, 's'},
+			{"kremlin-shadow-mem-l0-entries", required_argument, NULL, 't'},
 			{NULL, 0, NULL, 0} // indicates end of options
 		};
 
@@ -100,9 +114,11 @@ void parseKremlinOptions(KremlinConfiguration &config,
 					config.setShadowMemType(ShadowMemorySkadu);
 				else if (strcmp(optarg, "dummy") == 0)
 					config.setShadowMemType(ShadowMemoryDummy);
+				else if (strcmp(optarg, "flat") == 0)
+					config.setShadowMemType(ShadowMemoryFlat);
 				else {
 					std::cerr << "ERROR: Invalid shadow memory type: " << optarg << std::endl;
-					std::cerr << "Valid options are: {skadu, stv, base, dummy}" << std::endl;
+					std::cerr << "Valid options are: {skadu, stv, base, flat, dummy}" << std::endl;
 					exit(1);
 				}
 
@@ -128,6 +144,114 @@ void parseKremlinOptions(KremlinConfiguration &config,
 				config.setMaxProfiledLevel(atoi(optarg));
 				break;
 
+			case 'i':
+				if (strcmp(optarg, "level") == 0)
+					config.setShadowMemLayout(ShadowLayoutLevelMajor);
+				else if (strcmp(optarg, "address") == 0)
+					config.setShadowMemLayout(ShadowLayoutAddressMajor);
+				else {
+					std::cerr << "ERROR: Invalid shadow memory layout: " << optarg << std::endl;
+					std::cerr << "Valid options are: {level, address}" << std::endl;
+					exit(1);
+				}
+
+				break;
+
+			case 'j': {
+				int ways = atoi(optarg);
+				if (ways < 1 || ways > 64 || (ways & (ways - 1)) != 0) {
+					std::cerr << "ERROR: Invalid shadow memory cache ways: " << optarg << std::endl;
+					std::cerr << "Must be a power of 2 between 1 and 64" << std::endl;
+					exit(1);
+				}
+				config.setShadowMemCacheWays(ways);
+				break;
+			}
+
+			case 'k':
+				if (strcmp(optarg, "lru") == 0)
+					config.setShadowMemCacheReplacement(ShadowCacheLRU);
+				else if (strcmp(optarg, "plru") == 0)
+					config.setShadowMemCacheReplacement(ShadowCachePLRU);
+				else {
+					std::cerr << "ERROR: Invalid shadow memory cache replacement: " << optarg << std::endl;
+					std::cerr << "Valid options are: {lru, plru}" << std::endl;
+					exit(1);
+				}
+
+				break;
+
+			case 'l':
+				config.setShadowMemCacheVictimEntries(atoi(optarg));
+				break;
+
+			case 'm':
+				if (strcmp(optarg, "lzo") == 0)
+					config.setShadowCodec(ShadowCodecLZO);
+				else if (strcmp(optarg, "bitpack") == 0)
+					config.setShadowCodec(ShadowCodecBitPack);
+				else {
+					std::cerr << "ERROR: Invalid shadow memory codec: " << optarg << std::endl;
+					std::cerr << "Valid options are: {lzo, bitpack}" << std::endl;
+					exit(1);
+				}
+
+				break;
+
+			case 'n':
+				config.setShadowSpillDir(optarg);
+				break;
+
+			case 'o':
+				config.setShadowSpillLimitInMB(atoi(optarg));
+				break;
+
+			case 'p':
+				if (strcmp(optarg, "none") == 0)
+					config.setHugePageMode(HugePagesNone);
+				else if (strcmp(optarg, "thp") == 0)
+					config.setHugePageMode(HugePagesTHP);
+				else if (strcmp(optarg, "hugetlb") == 0)
+					config.setHugePageMode(HugePagesHugeTLB);
+				else {
+					std::cerr << "ERROR: Invalid huge page mode: " << optarg << std::endl;
+					std::cerr << "Valid options are: {none, thp, hugetlb}" << std::endl;
+					exit(1);
+				}
+
+				break;
+
+			case 'q':
+				config.setShadowReleaseThresholdInMB(atoi(optarg));
+				break;
+
+			case 'r':
+				config.setMemLimitInMB(atoi(optarg));
+				break;
+
+			case 's': {
+				int granularity = atoi(optarg);
+				if (granularity < 4 || granularity > 64 
+					|| (granularity & (granularity - 1)) != 0) {
+					std::cerr << "ERROR: Invalid shadow granularity: " << optarg << std::endl;
+					std::cerr << "Must be a power of 2 between 4 and 64 (bytes)" << std::endl;
+					exit(1);
+				}
+				config.setShadowGranularity(granularity);
+				break;
+			}
+
+			case 't': {
+				int entries = atoi(optarg);
+				if (entries < 0 || entries > 8) {
+					std::cerr << "ERROR: Invalid number of L0 entries: " << optarg << std::endl;
+					std::cerr << "Must be between 0 (no L0) and 8" << std::endl;
+					exit(1);
+				}
+				config.setShadowMemL0Entries(entries);
+				break;
+			}
+
 			case '?':
 				if (optopt) {
 					native_args.push_back(strdup((char*)(&c)));
@@ -146,6 +270,9 @@ void parseKremlinOptions(KremlinConfiguration &config,
 	if (enable_sm_compress)
 		config.enableShadowMemCompression();
 
+	if (enable_sm_compress_async)
+		config.enableAsyncShadowMemCompression();
+
 	if (disable_rs)
 		config.disableRecursiveRegionSummarization();
 
@@ -1,4 +1,6 @@
-#include <map>
+#include <string.h> // for memcpy
+#include <time.h> // for clock_gettime
+#include <vector>
 
 #include "kremlin.h"
 #include "compression.h"
@@ -7,9 +9,13 @@
 #include "config.h"
 #include "minilzo.h"
 #include "debug.h"
+#include "MemMapAllocator.h"
+#include "SpillArena.hpp"
 
 static UInt64 _compSrcSize;
 static UInt64 _compDestSize;
+static UInt64 _decompCount;
+static UInt64 _decompNanos;
 static UInt64 totalAccess;
 static UInt64 totalEvict;
 
@@ -18,96 +24,365 @@ static UInt64 totalEvict;
 
 static HEAP_ALLOC(wrkmem, LZO1X_1_MEM_COMPRESS);
 
+// largest input we compress (a 32-bit TimeTable) and the worst case LZO
+// output for it
+static const unsigned MAX_DECOMP_SIZE = sizeof(Time) * TimeTable::TIMETABLE_SIZE;
+static const unsigned MAX_COMP_SIZE = 
+	MAX_DECOMP_SIZE + MAX_DECOMP_SIZE / 16 + 64 + 3;
+
+static UInt8 comp_scratch[MAX_COMP_SIZE];
+
+/*!
+ * @brief General purpose byte compression with LZO.
+ */
+class LZOCodec : public Codec {
+public:
+	const char* getName() { return "lzo"; }
+
+	lzo_uint compress(UInt8* src, lzo_uint src_size, UInt8* dst) {
+		lzo_uint dst_size = 0;
+		int result = lzo1x_1_compress(src, src_size, dst, &dst_size, wrkmem);
+		assert(result == LZO_E_OK);
+		return dst_size;
+	}
+
+	void decompress(UInt8* src, lzo_uint src_size, UInt8* dst, 
+					lzo_uintp dst_size) {
+		int result = lzo1x_decompress(src, src_size, dst, dst_size, NULL);
+		assert(result == LZO_E_OK);
+	}
+};
+
+/*!
+ * @brief Frame-of-reference and bit-packing for pages of 64-bit values.
+ *
+ * Shadow pages reach the codec as differences between neighboring
+ * timestamps, i.e. mostly small numbers of either sign. The first value is
+ * stored as is. The others are zigzag encoded so small negative values
+ * stay small, then split into blocks of BLOCK_SIZE values. Each block
+ * stores its minimum (the reference) and packs every value's offset from
+ * it in the fewest bits that fit the largest one.
+ *
+ * Layout: [kind][first value][one width byte per block][one reference per
+ * block][packed words]. A block of width w takes exactly w words. If all
+ * but the first value are zero (as for a constant page), only the kind and
+ * first value are stored. An all-zero page compresses to nothing.
+ */
+class BitPackCodec : public Codec {
+private:
+	static const unsigned BLOCK_SIZE = 64;
+	static const UInt8 KIND_FIRST_ONLY = 0;
+	static const UInt8 KIND_PACKED = 1;
+
+	static UInt64 ZigZag(UInt64 v) { return (v << 1) ^ (UInt64)((Int64)v >> 63); }
+	static UInt64 UnZigZag(UInt64 v) { return (v >> 1) ^ (0 - (v & 1)); }
+
+	static unsigned GetWidth(UInt64 v) {
+		unsigned width = 0;
+		while (width < 64 && (v >> width) != 0) ++width;
+		return width;
+	}
+
+	static void Store64(UInt8* dst, UInt64 v) { memcpy(dst, &v, sizeof(v)); }
+	static UInt64 Load64(UInt8* src) { 
+		UInt64 v; 
+		memcpy(&v, src, sizeof(v)); 
+		return v; 
+	}
+
+	/*!
+	 * Packs num values (< 2^width each) into width words at dst.
+	 */
+	static void Pack(UInt64* values, unsigned num, unsigned width, UInt8* dst) {
+		UInt64 words[BLOCK_SIZE];
+		memset(words, 0, sizeof(UInt64) * width);
+		for (unsigned i = 0; i < num; ++i) {
+			unsigned bit = i * width;
+			unsigned word = bit >> 6, shift = bit & 63;
+			words[word] |= values[i] << shift;
+			if (shift + width > 64) words[word + 1] |= values[i] >> (64 - shift);
+		}
+		memcpy(dst, words, sizeof(UInt64) * width);
+	}
+
+	/*!
+	 * Inverse of Pack: adds each unpacked value to ref. The loop has no
+	 * data-dependent branches so the compiler can vectorize it.
+	 */
+	static void Unpack(UInt8* src, unsigned num, unsigned width, UInt64 ref, 
+						UInt64* values) {
+		UInt64 words[BLOCK_SIZE + 1];
+		memcpy(words, src, sizeof(UInt64) * width);
+		words[width] = 0;
+		UInt64 mask = (width == 64) ? ~0ULL : ((1ULL << width) - 1);
+		for (unsigned i = 0; i < num; ++i) {
+			unsigned bit = i * width;
+			unsigned word = bit >> 6, shift = bit & 63;
+			// the high part is shifted in two steps so shift == 0 works
+			UInt64 v = (words[word] >> shift) 
+				| ((words[word + 1] << 1) << (63 - shift));
+			values[i] = ref + (v & mask);
+		}
+	}
+
+public:
+	const char* getName() { return "bitpack"; }
+
+	lzo_uint compress(UInt8* src, lzo_uint src_size, UInt8* dst) {
+		assert(src_size % sizeof(UInt64) == 0);
+		UInt64* values = (UInt64*)src;
+		unsigned num_values = src_size / sizeof(UInt64);
+
+		bool rest_zero = true;
+		for (unsigned i = 1; i < num_values && rest_zero; ++i) 
+			rest_zero = (values[i] == 0);
+		if (rest_zero && values[0] == 0) return 0;
+
+		UInt8* pos = dst;
+		*pos++ = rest_zero ? KIND_FIRST_ONLY : KIND_PACKED;
+		Store64(pos, values[0]);
+		pos += sizeof(UInt64);
+		if (rest_zero) return pos - dst;
+
+		unsigned num_rest = num_values - 1;
+		unsigned num_blocks = (num_rest + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		UInt8* widths = pos;
+		UInt8* refs = widths + num_blocks;
+		pos = refs + num_blocks * sizeof(UInt64);
+
+		UInt64 block[BLOCK_SIZE];
+		for (unsigned b = 0; b < num_blocks; ++b) {
+			unsigned start = 1 + b * BLOCK_SIZE;
+			unsigned num = num_values - start;
+			if (num > BLOCK_SIZE) num = BLOCK_SIZE;
+
+			UInt64 ref = ~0ULL, max = 0;
+			for (unsigned i = 0; i < num; ++i) {
+				block[i] = ZigZag(values[start + i]);
+				if (block[i] < ref) ref = block[i];
+				if (block[i] > max) max = block[i];
+			}
+			for (unsigned i = 0; i < num; ++i) block[i] -= ref;
+
+			unsigned width = GetWidth(max - ref);
+			widths[b] = width;
+			Store64(&refs[b * sizeof(UInt64)], ref);
+			Pack(block, num, width, pos);
+			pos += width * sizeof(UInt64);
+		}
+		return pos - dst;
+	}
+
+	void decompress(UInt8* src, lzo_uint src_size, UInt8* dst, 
+					lzo_uintp dst_size) {
+		assert(*dst_size % sizeof(UInt64) == 0);
+		UInt64* values = (UInt64*)dst;
+		unsigned num_values = *dst_size / sizeof(UInt64);
+
+		UInt8* pos = src;
+		UInt8 kind = *pos++;
+		values[0] = Load64(pos);
+		pos += sizeof(UInt64);
+		if (kind == KIND_FIRST_ONLY) {
+			memset(&values[1], 0, sizeof(UInt64) * (num_values - 1));
+			return;
+		}
+		assert(kind == KIND_PACKED);
+
+		unsigned num_rest = num_values - 1;
+		unsigned num_blocks = (num_rest + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		UInt8* widths = pos;
+		UInt8* refs = widths + num_blocks;
+		pos = refs + num_blocks * sizeof(UInt64);
+
+		for (unsigned b = 0; b < num_blocks; ++b) {
+			unsigned start = 1 + b * BLOCK_SIZE;
+			unsigned num = num_values - start;
+			if (num > BLOCK_SIZE) num = BLOCK_SIZE;
+
+			unsigned width = widths[b];
+			Unpack(pos, num, width, Load64(&refs[b * sizeof(UInt64)]), 
+					&values[start]);
+			pos += width * sizeof(UInt64);
+			for (unsigned i = 0; i < num; ++i)
+				values[start + i] = UnZigZag(values[start + i]);
+		}
+		assert((lzo_uint)(pos - src) == src_size);
+	}
+};
+
+static LZOCodec lzo_codec;
+static BitPackCodec bitpack_codec;
+static Codec* codec = &lzo_codec;
+
+static UInt64 getTimeInNsec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UInt64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*!
+ * @brief A pool of compressed payloads, one free list per size class.
+ *
+ * Sizes are rounded up to a multiple of CLASS_SIZE and blocks are carved
+ * from large chunks, so a payload wastes less than CLASS_SIZE bytes and
+ * allocating one is a free list pop rather than a malloc. Chunks are only
+ * given back to the system by deinit.
+ *
+ * Compressed payloads belong to the coldest level tables, so when a spill
+ * arena is given, chunks come from it (i.e. from disk) for as long as it
+ * has room, and from malloc after that.
+ */
+class PayloadPool {
+private:
+	static const unsigned CLASS_SHIFT = 4;
+	static const unsigned CLASS_SIZE = 1 << CLASS_SHIFT;
+	static const unsigned NUM_CLASSES = 
+		(MAX_COMP_SIZE + CLASS_SIZE - 1) / CLASS_SIZE + 1;
+	static const unsigned CHUNK_SIZE = 64 * 1024;
+
+	class FreeBlock {
+	public:
+		FreeBlock* next;
+	};
+
+	FreeBlock* free_lists[NUM_CLASSES];
+	std::vector<UInt8*> chunks; //!< chunks from malloc
+	SpillArena* spill; //!< where to get chunks first (may be NULL)
+	UInt64 num_spilled_chunks;
+	UInt8* chunk_pos; //!< unused part of the newest chunk
+	UInt8* chunk_end;
+
+	static unsigned GetClass(lzo_uint size) {
+		return (size + CLASS_SIZE - 1) >> CLASS_SHIFT;
+	}
+
+public:
+	void init(SpillArena* spill) {
+		memset(free_lists, 0, sizeof(free_lists));
+		chunk_pos = chunk_end = NULL;
+		this->spill = spill;
+		num_spilled_chunks = 0;
+	}
+
+	void deinit() {
+		for (unsigned i = 0; i < chunks.size(); ++i) ::free(chunks[i]);
+		chunks.clear();
+		init(NULL);
+	}
+
+	UInt64 getNumChunks() { return chunks.size() + num_spilled_chunks; }
+	UInt64 getBytesInMemory() { return chunks.size() * CHUNK_SIZE; }
+	UInt64 getNumSpilledChunks() { return num_spilled_chunks; }
+
+	UInt8* alloc(lzo_uint size) {
+		unsigned size_class = GetClass(size);
+		assert(size_class > 0 && size_class < NUM_CLASSES);
+
+		FreeBlock* block = free_lists[size_class];
+		if (block != NULL) {
+			free_lists[size_class] = block->next;
+			return (UInt8*)block;
+		}
+
+		lzo_uint block_size = size_class << CLASS_SHIFT;
+		if (chunk_pos == NULL || chunk_pos + block_size > chunk_end) {
+			chunk_pos = (spill != NULL) ? spill->alloc(CHUNK_SIZE) : NULL;
+			if (chunk_pos != NULL) {
+				num_spilled_chunks++;
+			}
+			else {
+				chunk_pos = (UInt8*)malloc(CHUNK_SIZE);
+				assert(chunk_pos != NULL);
+				chunks.push_back(chunk_pos);
+			}
+			chunk_end = chunk_pos + CHUNK_SIZE;
+		}
+		UInt8* ret = chunk_pos;
+		chunk_pos += block_size;
+		return ret;
+	}
+
+	void free(UInt8* data, lzo_uint size) {
+		unsigned size_class = GetClass(size);
+		assert(size_class > 0 && size_class < NUM_CLASSES);
+		FreeBlock* block = (FreeBlock*)data;
+		block->next = free_lists[size_class];
+		free_lists[size_class] = block;
+	}
+};
+
+static PayloadPool payload_pool;
+static SpillArena spill_arena;
+
+// payloads are allocated by the compression thread and freed by the
+// application thread when compression runs in the background
+static pthread_mutex_t payload_lock = PTHREAD_MUTEX_INITIALIZER;
 
 UInt8* compressData(UInt8* decomp_data, lzo_uint decomp_size, 
 					lzo_uintp comp_size) {
 	assert(decomp_data != NULL);
 	assert(decomp_size > 0);
+	assert(decomp_size <= MAX_DECOMP_SIZE);
 	assert(comp_size != NULL);
 
-	//XXX need a specialized memory allocator, for now, just check the 
+	*comp_size = codec->compress(decomp_data, decomp_size, comp_scratch);
+	assert(*comp_size <= MAX_COMP_SIZE);
 
-	//UInt8 *comp_data = MemPoolAlloc();
-	UInt8 *comp_data = (UInt8*)malloc(decomp_size);
-	int result = lzo1x_1_compress(decomp_data, decomp_size, comp_data, comp_size, wrkmem);
-	assert(result == LZO_E_OK);
-	//memcpy(comp_data, decomp_data, decomp_size);
-	//*comp_size  = decomp_size;
+	UInt8 *comp_data = NULL;
+	if (*comp_size > 0) {
+		pthread_mutex_lock(&payload_lock);
+		comp_data = payload_pool.alloc(*comp_size);
+		pthread_mutex_unlock(&payload_lock);
+		memcpy(comp_data, comp_scratch, *comp_size);
+	}
 
 	//MSG(3, "compressed from %d to %d\n", decomp_size, *comp_size);
 	_compSrcSize += decomp_size;
 	_compDestSize += *comp_size;
 
-	assert(comp_data != NULL);
 	return comp_data;
 }
 
 void decompressData(UInt8* decomp_data, UInt8* comp_data, 
 					lzo_uint comp_size, lzo_uintp decomp_size) {
-	assert(comp_data != NULL);
 	assert(decomp_data != NULL);
-	assert(comp_size > 0);
 	assert(decomp_size != NULL);
 
-	int result = lzo1x_decompress(comp_data, comp_size, decomp_data, decomp_size, NULL);
-	assert(result == LZO_E_OK);
-	//memcpy(decomp_data, comp_data, comp_size);
-	//*decomp_size = comp_size;
-
-	//MSG(3, "decompressed from %d to %d\n", comp_size, *decomp_size);
-	//MemPoolFree(comp_data);
-	free(comp_data);
-	comp_data = NULL;
-	assert(comp_data == NULL);
-}
-
-/*
- * BEGIN ACTIVE SET MAINTENANCE CODE.
- */
-
-/*!
- * An entry in the active set of uncompressed level tables.
- */
-class ActiveSetEntry {
-public:
-	UInt16 r_bit;
-	UInt32 code; // TODO: make this debug mode only
-	ActiveSetEntry() : r_bit(1), code(0xDEADBEEF) {}
-	~ActiveSetEntry() {}
-
-	void* operator new(size_t size) {
-		return MemPoolAllocSmall(sizeof(ActiveSetEntry));
+	if (comp_size == 0) {
+		// an all-zero page has no payload
+		memset(decomp_data, 0, *decomp_size);
+		return;
 	}
-	void operator delete(void *ptr) {
-		MemPoolFreeSmall(ptr, sizeof(ActiveSetEntry));
-	}
-};
 
-typedef std::map<LevelTable*, ActiveSetEntry*>::iterator active_set_iterator;
+	assert(comp_data != NULL);
+	UInt64 start = getTimeInNsec();
+	codec->decompress(comp_data, comp_size, decomp_data, decomp_size);
+	_decompNanos += getTimeInNsec() - start;
+	_decompCount++;
 
-static std::map<LevelTable*, ActiveSetEntry*> active_set;
-static active_set_iterator active_set_clock_hand;
+	//MSG(3, "decompressed from %d to %d\n", comp_size, *decomp_size);
+	freeCompressedData(comp_data, comp_size);
+}
 
-/*! \brief Move "clockhand" to next entry in active set */
-static inline void advanceClockHand() {
-	++active_set_clock_hand;
-	if (active_set_clock_hand == active_set.end())
-		active_set_clock_hand = active_set.begin();
+void freeCompressedData(UInt8* comp_data, lzo_uint comp_size) {
+	if (comp_size == 0) return;
+	assert(comp_data != NULL);
+	pthread_mutex_lock(&payload_lock);
+	payload_pool.free(comp_data, comp_size);
+	pthread_mutex_unlock(&payload_lock);
 }
 
-/*! \brief Prints all entries in the active set.  */
-static inline void printActiveSet() {
-	unsigned i = 0;
-	for(active_set_iterator it = active_set.begin(); 
-			it != active_set.end(); ++it, ++i) {
-		if (it == active_set_clock_hand) MSG(3,"*");
-		MSG(3,"%u: key = %p, r_bit = %hu\n", i, it->first, it->second->r_bit);
-	}
+void CBuffer::init(unsigned size, bool enabled) {
+	assert(size > 0);
+	this->enabled = false;
+	this->use_worker = false;
+	if (enabled) enable(size);
 }
 
-void CBuffer::init(unsigned size) {
+void CBuffer::enable(unsigned size) {
 	assert(size > 0);
-	if (!kremlin_config.compressShadowMem()) return;
+	assert(!enabled);
 
 	MSG(2,"Initializing compression buffer to size %d\n",size);
 	
@@ -118,66 +393,244 @@ void CBuffer::init(unsigned size) {
 	    return;
 	}
 
+	if (kremlin_config.getShadowCodec() == ShadowCodecBitPack)
+		codec = &bitpack_codec;
+	else
+		codec = &lzo_codec;
+
+	this->enabled = true;
 	this->num_entries = size;
+	this->clock_hand = NULL;
+	this->active_size = 0;
+
+	bool spill = kremlin_config.spillShadowMem() && 
+		spill_arena.init(kremlin_config.getShadowSpillDir(), 
+			(UInt64)kremlin_config.getShadowSpillLimitInMB() << 20);
+	payload_pool.init(spill ? &spill_arena : NULL);
+
+	if (kremlin_config.compressShadowMemAsync()) {
+		this->stopping = false;
+		this->pending_gain = 0;
+		pthread_mutex_init(&queue_lock, NULL);
+		pthread_cond_init(&queue_ready, NULL);
+		pthread_cond_init(&table_done, NULL);
+		if (pthread_create(&worker, NULL, WorkerMain, this) == 0)
+			this->use_worker = true;
+		else
+			fprintf(stderr, "[kremlin] WARNING: couldn't start the compression "
+					"thread; compressing synchronously.\n");
+	}
+}
+
+void CBuffer::stopWorker() {
+	if (!use_worker) return;
+
+	pthread_mutex_lock(&queue_lock);
+	stopping = true;
+	pthread_cond_signal(&queue_ready);
+	pthread_mutex_unlock(&queue_lock);
+	pthread_join(worker, NULL);
+	use_worker = false;
+
+	// whatever is still queued was never compressed
+	for (unsigned i = 0; i < queue.size(); ++i)
+		SetCompressState(queue[i], COMPRESS_IDLE);
+	queue.clear();
+	collectWorkerResults();
+
+	pthread_cond_destroy(&table_done);
+	pthread_cond_destroy(&queue_ready);
+	pthread_mutex_destroy(&queue_lock);
+}
+
+/*
+ * The state is read without holding queue_lock (see isPending), so it is
+ * published with release/acquire: once the application thread sees
+ * COMPRESS_IDLE, the helper thread's writes to the table are visible.
+ */
+UInt8 CBuffer::GetCompressState(LevelTable *table) {
+	return __atomic_load_n(&table->compress_state, __ATOMIC_ACQUIRE);
+}
+
+void CBuffer::SetCompressState(LevelTable *table, CompressState state) {
+	__atomic_store_n(&table->compress_state, (UInt8)state, __ATOMIC_RELEASE);
+}
+
+void* CBuffer::WorkerMain(void* cbuffer) {
+	((CBuffer*)cbuffer)->runWorker();
+	return NULL;
+}
+
+void CBuffer::runWorker() {
+	std::vector<Time*> retired;
+
+	pthread_mutex_lock(&queue_lock);
+	while (true) {
+		while (queue.empty() && !stopping)
+			pthread_cond_wait(&queue_ready, &queue_lock);
+		if (stopping) break;
+
+		LevelTable* table = queue.front();
+		queue.pop_front();
+		SetCompressState(table, COMPRESS_RUNNING);
+		pthread_mutex_unlock(&queue_lock);
+
+		int gain = table->compress(&retired);
+
+		pthread_mutex_lock(&queue_lock);
+		retired_arrays.insert(retired_arrays.end(), retired.begin(), retired.end());
+		retired.clear();
+		pending_gain += gain;
+		SetCompressState(table, COMPRESS_IDLE);
+		pthread_cond_broadcast(&table_done);
+	}
+	pthread_mutex_unlock(&queue_lock);
+}
+
+int CBuffer::collectWorkerResults() {
+	std::vector<Time*> retired;
+
+	pthread_mutex_lock(&queue_lock);
+	int gain = pending_gain;
+	pending_gain = 0;
+	retired.swap(retired_arrays);
+	pthread_mutex_unlock(&queue_lock);
+
+	for (unsigned i = 0; i < retired.size(); ++i)
+		MemPoolFree(retired[i]);
+	return gain;
+}
+
+bool CBuffer::isPending(LevelTable *table) {
+	return GetCompressState(table) != COMPRESS_IDLE;
+}
+
+bool CBuffer::claim(LevelTable *table) {
+	assert(table != NULL);
+	if (!isPending(table)) return false;
+
+	bool dequeued = false;
+	pthread_mutex_lock(&queue_lock);
+	if (GetCompressState(table) == COMPRESS_QUEUED) {
+		for (std::deque<LevelTable*>::iterator it = queue.begin(); 
+				it != queue.end(); ++it) {
+			if (*it == table) {
+				queue.erase(it);
+				break;
+			}
+		}
+		SetCompressState(table, COMPRESS_IDLE);
+		dequeued = true;
+	}
+	while (GetCompressState(table) == COMPRESS_RUNNING)
+		pthread_cond_wait(&table_done, &queue_lock);
+	pthread_mutex_unlock(&queue_lock);
+	return dequeued;
 }
 
 void CBuffer::deinit() {
+	MSG(2, "Payload chunks (total / spilled to disk) = %llu / %llu\n",
+		payload_pool.getNumChunks(), payload_pool.getNumSpilledChunks());
+	if (enabled) payload_pool.deinit();
+	spill_arena.deinit();
 	MSG(2, "CBuffer (evict / access / ratio) = %llu, %llu, %.2f\n",
 		totalEvict, totalAccess, ((double)totalEvict / totalAccess) * 100.0);
 	MSG(2, "Compression Overall Rate = %.2f X\n", (double)_compSrcSize / _compDestSize);
+	MSG(2, "Decompression (codec / count / avg ns) = %s / %llu / %.1f\n",
+		codec->getName(), _decompCount, (double)_decompNanos / _decompCount);
 }
 
-/*! \brief Find an entry to remove from active set.
- *
- * \return The active set entry that should be removed.
- * \remark This simply returns an entry that should be removed. It does not
- * actually remove the entry.
- */
-active_set_iterator getVictim() {
-	// set active_set_clock_hand to entry that will be removed
-	while(active_set_clock_hand->second->r_bit == 1) {
-		active_set_clock_hand->second->r_bit = 0;
-		// TODO: these asserts need to go bye-bye
-		assert(active_set_clock_hand->second->code == 0xDEADBEEF);
-		assert(active_set_clock_hand->first->code == 0xDEADBEEF);
-		advanceClockHand();
-	}
+LevelTable* CBuffer::getVictim() {
+	assert(clock_hand != NULL);
 
-	// TODO: these asserts need to go bye-bye
-	assert(active_set_clock_hand->first->code == 0xDEADBEEF);
-	assert(active_set_clock_hand->second->code == 0xDEADBEEF);
+	// give every recently referenced table a second chance
+	while (clock_hand->clock_ref) {
+		clock_hand->clock_ref = false;
+		assert(clock_hand->code == 0xDEADBEEF);
+		clock_hand = clock_hand->clock_next;
+	}
 
-	active_set_iterator ret = active_set_clock_hand;
-	advanceClockHand();
-	return ret;
+	assert(clock_hand->code == 0xDEADBEEF);
+	return clock_hand;
 }
 
 void CBuffer::addToBuffer(LevelTable *l_table) {
 	assert(l_table != NULL);
+	assert(!l_table->in_active_set);
+
+	// insert just behind the clock hand so the new table is considered last
+	if (clock_hand == NULL) {
+		l_table->clock_prev = l_table->clock_next = l_table;
+		clock_hand = l_table;
+	} else {
+		l_table->clock_next = clock_hand;
+		l_table->clock_prev = clock_hand->clock_prev;
+		clock_hand->clock_prev->clock_next = l_table;
+		clock_hand->clock_prev = l_table;
+	}
+	l_table->clock_ref = true;
+	l_table->in_active_set = true;
+	++active_size;
+	// TODO: assert active_size size is less than num_entries
+}
 
-	//fprintf(stderr, "adding l_table 0x%llx\n", l_table);
-	ActiveSetEntry *as = new ActiveSetEntry();
-	active_set.insert( std::pair<LevelTable*, ActiveSetEntry*>(l_table, as) );
+void CBuffer::removeFromBuffer(LevelTable *l_table) {
+	assert(l_table->in_active_set);
 
-	// TRICKY: size will only be 1 the first time we add something to the
-	// buffer so we'll go ahead and initialize the clock hand to that first
-	// entry
-	if (active_set.size() == 1) active_set_clock_hand = active_set.begin();
-	// TODO: assert active_size size is less than num_entries
+	if (l_table->clock_next == l_table) {
+		clock_hand = NULL;
+	} else {
+		if (clock_hand == l_table) clock_hand = l_table->clock_next;
+		l_table->clock_prev->clock_next = l_table->clock_next;
+		l_table->clock_next->clock_prev = l_table->clock_prev;
+	}
+	l_table->clock_prev = l_table->clock_next = NULL;
+	l_table->in_active_set = false;
+	--active_size;
 }
 
 int CBuffer::evictFromBuffer() {
-	active_set_iterator victim = getVictim();
-	assert(victim->second->code == 0xDEADBEEF);
-	LevelTable* lTable = victim->first;
-	int bytes_gained = lTable->compress();
+	LevelTable* lTable = getVictim();
+	removeFromBuffer(lTable);
 	totalEvict++;
-	delete victim->second;
-	victim->second = NULL;
-	active_set.erase(victim);
+
+	if (!use_worker)
+		return lTable->compress();
+
+	pthread_mutex_lock(&queue_lock);
+	SetCompressState(lTable, COMPRESS_QUEUED);
+	queue.push_back(lTable);
+	pthread_cond_signal(&queue_ready);
+	pthread_mutex_unlock(&queue_lock);
+
+	// the savings for this table are reported by a later call
+	return collectWorkerResults();
+}
+
+int CBuffer::shrink(unsigned new_size) {
+	assert(new_size > 0);
+	if (!enabled) return 0;
+
+	int bytes_gained = 0;
+	this->num_entries = new_size;
+	while (active_size > num_entries) {
+		bytes_gained += evictFromBuffer();
+	}
 	return bytes_gained;
 }
 
+void CBuffer::grow(unsigned new_size) {
+	assert(new_size >= num_entries);
+	this->num_entries = new_size;
+}
+
+UInt64 CBuffer::getPayloadBytesInMemory() {
+	pthread_mutex_lock(&payload_lock);
+	UInt64 bytes = payload_pool.getBytesInMemory();
+	pthread_mutex_unlock(&payload_lock);
+	return bytes;
+}
+
 int CBuffer::decompress(LevelTable *table) {
 	assert(table != NULL);
 
@@ -190,11 +643,11 @@ int CBuffer::add(LevelTable *table) {
 	assert(table != NULL);
 	assert(table->code == 0xDEADBEEF);
 
-	if (!kremlin_config.compressShadowMem()) return 0;
+	if (!enabled) return 0;
 
 	int bytes_gained = 0;
 	// XXX: is next line really >=. Why not just >? (-sat)
-	if(active_set.size() >= this->num_entries) {
+	if(active_size >= this->num_entries) {
 		bytes_gained = evictFromBuffer();
 	}
 
@@ -204,15 +657,12 @@ int CBuffer::add(LevelTable *table) {
 
 void CBuffer::touch(LevelTable *table) {
 	assert(table != NULL);
-	if (!kremlin_config.compressShadowMem()) return;
+	if (!enabled) return;
 
-	active_set_iterator it = active_set.find(table);
-	if (it == active_set.end()) {
+	if (!table->in_active_set) {
 		fprintf(stderr, "[1] as not found for lTable 0x%p\n", table);
 	}
-	assert(it != active_set.end());
-	ActiveSetEntry *as = it->second;
-	assert(as->code == 0xDEADBEEF);
-	as->r_bit = 1;
+	assert(table->in_active_set);
+	table->clock_ref = true;
 	totalAccess++;
 }
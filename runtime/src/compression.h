@@ -1,18 +1,87 @@
 #ifndef _CBUFFER_H
 #define _CBUFFER_H
 
+#include <deque>
+#include <pthread.h>
+#include <vector>
+#include "ktypes.h"
 #include "lzoconf.h"
 
 class LevelTable;
 
+/*!
+ * @brief A lossless codec used to compress shadow memory pages.
+ *
+ * The codec is selected with --kremlin-shadow-codec.
+ */
+class Codec {
+public:
+	virtual ~Codec() {}
+
+	virtual const char* getName() = 0;
+
+	/*! @brief Compresses a buffer.
+	 *
+	 * @param src The data to compress.
+	 * @param src_size The size of src (in bytes).
+	 * @param[out] dst Where to write the compressed data. Must have room
+	 * for the codec's worst case output.
+	 * @return The size of the compressed data. Zero means the data was all
+	 * zeros and nothing was written.
+	 */
+	virtual lzo_uint compress(UInt8* src, lzo_uint src_size, UInt8* dst) = 0;
+
+	/*! @brief Decompresses a buffer produced by compress.
+	 *
+	 * @param src The compressed data.
+	 * @param src_size The size of src (in bytes), which is positive.
+	 * @param[out] dst Where to write the decompressed data.
+	 * @param[in,out] dst_size The size of dst on input; the size of the
+	 * decompressed data on output.
+	 */
+	virtual void decompress(UInt8* src, lzo_uint src_size, UInt8* dst, 
+							lzo_uintp dst_size) = 0;
+};
+
+/*!
+ * @brief Keeps the most recently used level tables uncompressed and
+ * compresses the others.
+ *
+ * Tables evicted from the active set are normally compressed right away.
+ * With --kremlin-compress-shadow-mem-async, they are queued for a helper
+ * thread instead. Until the helper is done with a table it must not be
+ * touched by anyone else: the application thread first calls claim (see
+ * below), and the garbage collector skips tables for which isPending is
+ * true. Decompression always happens on the application thread.
+ */
 class CBuffer {
 public:
+	/*! Where a level table is in the background compression pipeline. */
+	enum CompressState {
+		COMPRESS_IDLE = 0,	//!< owned by the application thread
+		COMPRESS_QUEUED = 1,	//!< waiting for the helper thread
+		COMPRESS_RUNNING = 2	//!< being compressed by the helper thread
+	};
+
 	/*! @brief Initializes the compression buffer.
 	 *
 	 * @param size The number of entries allowed in the compression buffer.
+	 * @param enabled If false, the buffer does nothing until enable() is
+	 * called.
 	 * @pre size is positive.
 	 */
-	void init(unsigned size);
+	void init(unsigned size, bool enabled);
+
+	/*! @brief Starts compressing level tables, with the codec, spill arena
+	 * and helper thread selected in the configuration.
+	 *
+	 * @param size The number of entries allowed in the compression buffer.
+	 * @pre size is positive and the buffer is not enabled yet.
+	 */
+	void enable(unsigned size);
+
+	/*! @brief Returns true if level tables are being compressed. */
+	bool isEnabled() { return enabled; }
 
 	/*! \brief De-initializes the compression buffer. */
 	void deinit();
@@ -41,8 +110,101 @@ public:
 	 */
 	int decompress(LevelTable *table);
 
+	/*! @brief Takes a level table back from the helper thread.
+	 *
+	 * A queued table is removed from the queue, uncompressed. If the table
+	 * is being compressed, this waits until it is done. Cheap when the table
+	 * isn't pending.
+	 *
+	 * @param table The level table about to be accessed.
+	 * @return true if the table was taken off the queue; it is then
+	 * uncompressed but not in the active set, so the caller must add it.
+	 * @pre table is non-NULL.
+	 */
+	bool claim(LevelTable *table);
+
+	/*! @brief Returns true if the helper thread may still access a table.
+	 */
+	bool isPending(LevelTable *table);
+
+	/*! @brief Compresses the least recently used tables until at most
+	 * new_size tables are uncompressed, and keeps it that way.
+	 *
+	 * @param new_size The new number of entries in the compression buffer.
+	 * @return The number of bytes gained.
+	 * @pre new_size is positive.
+	 */
+	int shrink(unsigned new_size);
+
+	/*! @brief Allows more uncompressed tables again, e.g. to undo a
+	 * shrink(). Compressed tables stay compressed until they are accessed.
+	 *
+	 * @param new_size The new number of entries in the compression buffer.
+	 * @pre new_size is at least the current number of entries.
+	 */
+	void grow(unsigned new_size);
+
+	/*! @brief Returns the number of entries allowed in the buffer. */
+	unsigned getSize() { return num_entries; }
+
+	/*! @brief Returns the number of uncompressed tables. */
+	unsigned getActiveSize() { return active_size; }
+
+	/*! @brief Returns the bytes of compressed payloads held in RAM, i.e.
+	 * not in the spill arena. */
+	UInt64 getPayloadBytesInMemory();
+
+	/*! @brief Waits for the helper thread to finish its current table and
+	 * stops it. Queued tables are left uncompressed.
+	 */
+	void stopWorker();
+
 private:
+	bool enabled; //!< false until level tables are to be compressed
 	unsigned num_entries; //!< number of entries in the compression buffer
+
+	bool use_worker; //!< compress on the helper thread
+	pthread_t worker;
+	pthread_mutex_t queue_lock; //!< protects everything below
+	pthread_cond_t queue_ready; //!< signaled when work is queued or stopping
+	pthread_cond_t table_done; //!< signaled when a table is compressed
+	std::deque<LevelTable*> queue; //!< tables waiting for compression
+	bool stopping;
+	Int64 pending_gain; //!< bytes saved but not yet reported
+	std::vector<Time*> retired_arrays; //!< uncompressed arrays to free
+
+	static UInt8 GetCompressState(LevelTable *table);
+	static void SetCompressState(LevelTable *table, CompressState state);
+	static void* WorkerMain(void* cbuffer);
+	void runWorker();
+
+	/*! \brief Frees what the helper thread retired and returns the bytes
+	 * it saved since the last call. */
+	int collectWorkerResults();
+
+	/*
+	 * The active set of uncompressed level tables is a circular list
+	 * threaded through the LevelTables themselves (see
+	 * LevelTable::clock_next), so touching a table and picking a victim
+	 * never search.
+	 */
+	LevelTable *clock_hand; //!< next table the clock will consider
+	unsigned active_size; //!< number of tables in the active set
+
+	/*! \brief Unlinks a level table from the active set.
+	 *
+	 * \param l_table The level table to remove.
+	 * \pre l_table is in the active set.
+	 */
+	void removeFromBuffer(LevelTable *l_table);
+
+	/*! \brief Find an entry to remove from the active set.
+	 *
+	 * \return The level table that should be removed.
+	 * \remark This does not actually remove the entry.
+	 * \pre The active set is not empty.
+	 */
+	LevelTable* getVictim();
 	
 	/*! \brief Adds a level table entry to the compression buffer.
 	 *
@@ -58,29 +220,42 @@ private:
 	int evictFromBuffer();
 };
 
-/*! @brief Compress data using LZO library
+/*! @brief Compress data using the selected codec
+ *
+ * The compressed data is copied into a block from a size-classed pool, so
+ * it only takes about as much memory as it needs. The block must be
+ * returned with decompressData or freeCompressedData.
  *
  * @param decomp_data The data to be compressed
  * @param decomp_size The size of input data (in bytes)
  * @param[out] comp_size The size data after compressed
- * @return Pointer to the beginning of compressed data
+ * @return Pointer to the beginning of compressed data, or NULL if
+ * comp_size is 0 (the data was all zeros).
  * @pre decomp_data is non-NULL.
  * @pre decomp_size is positive.
  * @pre comp_size is non-NULL.
- * @post Returned pointer is non-NULL.
  */
 UInt8* compressData(UInt8* decomp_data, lzo_uint decomp_size, lzo_uintp comp_size);
 
-/*! @brief Decompress data using LZO library
+/*! @brief Decompress data using the selected codec
  *
  * @param decomp_data Chunk of memory where decompressed data is written.
  * @param comp_data Pointer to the data to be decompressed.
  * @param comp_size Size of the compressed data (in bytes)
- * @param[out] decomp_size Size of the decompressed data (in bytes)
- * @pre comp_data, decomp_data, and decomp_size are all non-NULL.
- * @pre comp_size is positive.
- * @post comp_data will point to NULL.
+ * @param[in,out] decomp_size Size of decomp_data on input; size of the
+ * decompressed data on output (in bytes).
+ * @pre decomp_data and decomp_size are non-NULL.
+ * @pre comp_data is non-NULL unless comp_size is 0.
+ * @post comp_data has been freed.
  */
 void decompressData(UInt8* decomp_data, UInt8* comp_data, lzo_uint comp_size, lzo_uintp decomp_size);
 
+/*! @brief Frees compressed data without decompressing it.
+ *
+ * @param comp_data Pointer returned by compressData.
+ * @param comp_size The compressed size returned by compressData.
+ * @pre comp_data is non-NULL unless comp_size is 0.
+ */
+void freeCompressedData(UInt8* comp_data, lzo_uint comp_size);
+
 #endif
@@ -21,16 +21,67 @@ void KremlinConfiguration::print() {
 			if (shadow_mem_cache_size_in_mb > 0) {
 				std::cerr << "\t\tCache size: " 
 					<< shadow_mem_cache_size_in_mb << "MB\n";
+				std::cerr << "\t\tCache associativity: ";
+				if (shadow_mem_cache_ways > 1) {
+					std::cerr << shadow_mem_cache_ways << "-way, "
+						<< (shadow_mem_cache_replacement == ShadowCachePLRU ?
+							"pseudo-LRU" : "LRU") << "\n";
+				}
+				else
+					std::cerr << "direct-mapped\n";
+				if (shadow_mem_cache_victim_entries > 0) {
+					std::cerr << "\t\tVictim buffer: " 
+						<< shadow_mem_cache_victim_entries << " entries\n";
+				}
 			}
+			if (shadow_mem_l0_entries > 0) {
+				std::cerr << "\t\tL0 filter: " 
+					<< shadow_mem_l0_entries << " entries\n";
+			}
+
+			std::cerr << "\t\tGranularity: " << shadow_granularity 
+				<< " bytes\n";
+
+			if (shadow_mem_layout == ShadowLayoutAddressMajor)
+				std::cerr << "\t\tLayout: address-major\n";
+			else
+				std::cerr << "\t\tLayout: level-major\n";
 
 			if (compress_shadow_mem) {
 				std::cerr << "\t\tCompression enabled: ";
 				std::cerr << num_compression_buffer_entries
-					<< " compression buffer entries\n";
+					<< " compression buffer entries, "
+					<< (shadow_codec == ShadowCodecBitPack ? 
+						"bitpack" : "LZO") << " codec"
+					<< (compress_shadow_mem_async ? 
+						", in the background" : "") << "\n";
 			}
 			else
 				std::cerr << "\t\tCompression disabled\n";
 
+			if (!shadow_spill_dir.empty()) {
+				std::cerr << "\t\tSpilling compressed shadow memory to "
+					<< shadow_spill_dir << ", up to " 
+					<< shadow_spill_limit_in_mb << "MB\n";
+			}
+
+			if (huge_page_mode == HugePagesTHP)
+				std::cerr << "\t\tHuge pages: transparent\n";
+			else if (huge_page_mode == HugePagesHugeTLB)
+				std::cerr << "\t\tHuge pages: explicit (hugetlb)\n";
+
+			if (shadow_release_threshold_in_mb > 0) {
+				std::cerr << "\t\tFree shadow memory over " 
+					<< shadow_release_threshold_in_mb 
+					<< "MB is returned to the OS\n";
+			}
+			else
+				std::cerr << "\t\tFree shadow memory is kept\n";
+
+			if (mem_limit_in_mb > 0) {
+				std::cerr << "\t\tMemory limit: " << mem_limit_in_mb << "MB\n";
+			}
+
 			if (garbage_collection_period > 0) {
 				std::cerr << "\t\tGarbage collection enabled, period = "
 					<< garbage_collection_period << "\n";
@@ -40,6 +91,10 @@ void KremlinConfiguration::print() {
 
 			break;
 		}
+		case ShadowMemoryFlat: {
+			std::cerr << "Flat" << "\n";
+			break;
+		}
 		case ShadowMemoryDummy: {
 			std::cerr << "Dummy" << "\n";
 			break;
@@ -8,7 +8,29 @@ enum ShadowMemoryType {
 	ShadowMemoryBase = 0,
 	ShadowMemorySTV = 1,
 	ShadowMemorySkadu = 2,
-	ShadowMemoryDummy = 3
+	ShadowMemoryDummy = 3,
+	ShadowMemoryFlat = 4
+};
+
+enum ShadowMemoryLayout {
+	ShadowLayoutLevelMajor = 0, //!< one TimeTable per level
+	ShadowLayoutAddressMajor = 1 //!< all levels of a word are contiguous
+};
+
+enum ShadowCacheReplacement {
+	ShadowCacheLRU = 0, //!< true least recently used
+	ShadowCachePLRU = 1 //!< tree pseudo-LRU
+};
+
+enum ShadowCodec {
+	ShadowCodecLZO = 0, //!< general purpose LZO compression
+	ShadowCodecBitPack = 1 //!< frame-of-reference plus bit-packing
+};
+
+enum HugePageMode {
+	HugePagesNone = 0, //!< normal pages only
+	HugePagesTHP = 1, //!< ask for transparent huge pages (madvise)
+	HugePagesHugeTLB = 2 //!< explicit huge pages, falling back to THP
 };
 
 class KremlinConfiguration {
@@ -19,11 +41,27 @@ private:
 	ShadowMemoryType shadow_mem_type;
 
 	UInt32 shadow_mem_cache_size_in_mb;
+	ShadowMemoryLayout shadow_mem_layout;
+	UInt32 shadow_mem_cache_ways;
+	ShadowCacheReplacement shadow_mem_cache_replacement;
+	UInt32 shadow_mem_cache_victim_entries;
+	UInt32 shadow_mem_l0_entries; //!< 0 if there is no L0 filter
+	UInt32 shadow_granularity; //!< bytes that share timestamps
 
 	UInt32 garbage_collection_period;
 
 	bool compress_shadow_mem;
+	bool compress_shadow_mem_async;
 	UInt32 num_compression_buffer_entries;
+	ShadowCodec shadow_codec;
+
+	std::string shadow_spill_dir; //!< empty if spilling is disabled
+	UInt32 shadow_spill_limit_in_mb;
+
+	HugePageMode huge_page_mode;
+	UInt32 shadow_release_threshold_in_mb;
+
+	UInt32 mem_limit_in_mb; //!< 0 if there is no memory budget
 
 	bool summarize_recursive_regions;
 
@@ -34,12 +72,24 @@ private:
 
 public:
 
-	KremlinConfiguration() : compress_shadow_mem(false),
-							min_profiled_level(0), max_profiled_level(32), 
-							num_compression_buffer_entries(4096),
-							shadow_mem_cache_size_in_mb(4), 
+	KremlinConfiguration() : min_profiled_level(0), max_profiled_level(32), 
 							shadow_mem_type(ShadowMemorySkadu),
+							shadow_mem_cache_size_in_mb(4), 
+							shadow_mem_layout(ShadowLayoutLevelMajor),
+							shadow_mem_cache_ways(1),
+							shadow_mem_cache_replacement(ShadowCacheLRU),
+							shadow_mem_cache_victim_entries(0),
+							shadow_mem_l0_entries(0),
+							shadow_granularity(8),
 							garbage_collection_period(1024), 
+							compress_shadow_mem(false),
+							compress_shadow_mem_async(false),
+							num_compression_buffer_entries(4096),
+							shadow_codec(ShadowCodecLZO),
+							shadow_spill_limit_in_mb(16384),
+							huge_page_mode(HugePagesNone),
+							shadow_release_threshold_in_mb(64),
+							mem_limit_in_mb(0),
 							summarize_recursive_regions(true), 
 							profile_output_filename("kremlin.bin"),
 							debug_output_filename("kremlin.debug.log") {}
@@ -54,13 +104,33 @@ public:
 	Level getNumProfiledLevels() { return max_profiled_level - min_profiled_level + 1; }
 	ShadowMemoryType getShadowMemType() { return shadow_mem_type; }
 	UInt32 getShadowMemCacheSizeInMB() { return shadow_mem_cache_size_in_mb; }
+	ShadowMemoryLayout getShadowMemLayout() { return shadow_mem_layout; }
+	UInt32 getShadowMemCacheWays() { return shadow_mem_cache_ways; }
+	ShadowCacheReplacement getShadowMemCacheReplacement() { 
+		return shadow_mem_cache_replacement;
+	}
+	UInt32 getShadowMemCacheVictimEntries() { 
+		return shadow_mem_cache_victim_entries;
+	}
+	UInt32 getShadowMemL0Entries() { return shadow_mem_l0_entries; }
+	UInt32 getShadowGranularity() { return shadow_granularity; }
 	UInt32 getShadowMemGarbageCollectionPeriod() { 
 		return garbage_collection_period;
 	}
 	bool compressShadowMem() { return compress_shadow_mem; }
+	bool compressShadowMemAsync() { return compress_shadow_mem_async; }
 	UInt32 getNumCompressionBufferEntries() { 
 		return num_compression_buffer_entries;
 	}
+	ShadowCodec getShadowCodec() { return shadow_codec; }
+	bool spillShadowMem() { return !shadow_spill_dir.empty(); }
+	const char* getShadowSpillDir() { return shadow_spill_dir.c_str(); }
+	UInt32 getShadowSpillLimitInMB() { return shadow_spill_limit_in_mb; }
+	HugePageMode getHugePageMode() { return huge_page_mode; }
+	UInt32 getShadowReleaseThresholdInMB() { 
+		return shadow_release_threshold_in_mb;
+	}
+	UInt32 getMemLimitInMB() { return mem_limit_in_mb; }
 	bool summarizeRecursiveRegions() { return summarize_recursive_regions; }
 	const char* getProfileOutputFilename() { 
 		return profile_output_filename.c_str();
@@ -76,13 +146,37 @@ public:
 	void setShadowMemCacheSizeInMB(UInt32 s) {
 		shadow_mem_cache_size_in_mb = s;
 	}
+	void setShadowMemLayout(ShadowMemoryLayout l) { shadow_mem_layout = l; }
+	void setShadowMemCacheWays(UInt32 w) { shadow_mem_cache_ways = w; }
+	void setShadowMemCacheReplacement(ShadowCacheReplacement r) { 
+		shadow_mem_cache_replacement = r;
+	}
+	void setShadowMemCacheVictimEntries(UInt32 n) { 
+		shadow_mem_cache_victim_entries = n;
+	}
+	void setShadowMemL0Entries(UInt32 n) { shadow_mem_l0_entries = n; }
+	void setShadowGranularity(UInt32 g) { shadow_granularity = g; }
 	void setShadowMemGarbageCollectionPeriod(UInt32 p) { 
 		garbage_collection_period = p;
 	}
 	void enableShadowMemCompression() { compress_shadow_mem = true; }
+	void enableAsyncShadowMemCompression() { 
+		compress_shadow_mem_async = true;
+	}
 	void setNumCompressionBufferEntries(UInt32 n) { 
 		num_compression_buffer_entries = n;
 	}
+	void setShadowCodec(ShadowCodec c) { shadow_codec = c; }
+	void setShadowSpillDir(const char* dir) { 
+		shadow_spill_dir.clear();
+		shadow_spill_dir.append(dir);
+	}
+	void setShadowSpillLimitInMB(UInt32 s) { shadow_spill_limit_in_mb = s; }
+	void setHugePageMode(HugePageMode m) { huge_page_mode = m; }
+	void setShadowReleaseThresholdInMB(UInt32 t) { 
+		shadow_release_threshold_in_mb = t;
+	}
+	void setMemLimitInMB(UInt32 l) { mem_limit_in_mb = l; }
 	void disableRecursiveRegionSummarization() { 
 		summarize_recursive_regions = false;
 	}
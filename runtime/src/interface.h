@@ -65,6 +65,11 @@ void _KLoad4(Addr src_addr, Reg dest_reg, Reg src1_reg, Reg src2_reg, Reg src3_r
 void _KStore(Reg src_reg, Addr dest_addr, UInt32 memory_access_size); 
 void _KStoreConst(Addr dest_addr, UInt32 memory_access_size); 
 
+/* memcpy / memmove, and memset with a variable or constant value */
+void _KMemCopy(Addr dest_addr, Addr src_addr, UInt64 size);
+void _KMemSet(Reg src_reg, Addr dest_addr, UInt64 size);
+void _KMemSetConst(Addr dest_addr, UInt64 size);
+
 void _KPhi(Reg dest_reg, Reg src_reg, UInt32 num_ctrls, ...);
 void _KPhi1To1(Reg dest_reg, Reg src_reg, Reg ctrl_reg); 
 void _KPhi2To1(Reg dest_reg, Reg src_reg, Reg ctrl1_reg, Reg ctrl2_reg); 
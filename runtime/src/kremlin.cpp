@@ -18,6 +18,7 @@
 #include "MShadowBase.h"
 #include "MShadowSTV.h"
 #include "MShadowSkadu.h"
+#include "MShadowFlat.h"
 
 #include "Table.h"
 #include "RShadow.h"
@@ -33,6 +34,15 @@
 
 
 static KremlinProfiler *profiler;
+
+/*
+ * The frame of the _K function this is expanded in sits right below the
+ * instrumented caller's stack pointer (return address and saved frame
+ * pointer apart), so its address stands in for the caller's stack pointer.
+ * It has to be a macro: in a helper function it would be the helper's frame.
+ */
+#define getCallerStackPointer() ((Addr)__builtin_frame_address(0))
+
 KremlinConfiguration kremlin_config;
 
 extern "C" int __main(int argc, char** argv);
@@ -138,10 +148,26 @@ void KremlinProfiler::initShadowMemory() {
 		case ShadowMemorySkadu:
 			shadow_mem = new MShadowSkadu();
 			break;
+		case ShadowMemoryFlat:
+			if (MShadowFlat::CanReserveWindows()) {
+				shadow_mem = new MShadowFlat();
+				break;
+			}
+			fprintf(stderr, "[kremlin] WARNING: can't reserve address space "
+					"for flat shadow memory (too many levels, or is overcommit "
+					"disabled?); using skadu shadow memory instead.\n");
+			shadow_mem = new MShadowSkadu();
+			break;
 		default:
 			shadow_mem = new MShadowDummy();
 	}
 	shadow_mem->init();
+
+	if (shadow_mem->getGranularity() != kremlin_config.getShadowGranularity()) {
+		fprintf(stderr, "[kremlin] WARNING: this shadow memory type only "
+				"supports a granularity of %u bytes; using that.\n", 
+				shadow_mem->getGranularity());
+	}
 }
 
 void KremlinProfiler::deinitShadowMemory() {
@@ -281,7 +307,7 @@ void _KPopCDep() {
 
 
 void _KPrepCall(CID callSiteId, UInt64 calledRegionId) {
-	profiler->handlePrepCall(callSiteId, calledRegionId);
+	profiler->handlePrepCall(callSiteId, calledRegionId, getCallerStackPointer());
 }
 
 void _KEnqArg(Reg src) {
@@ -358,7 +384,7 @@ void _KEnterRegion(SID regionId, RegionType regionType) {
 	// profile any of the code in the pre-main constructors (just like we
 	// won't profile any code in post-main destructors)
 	if (profiler == NULL) initProfiler();
-	profiler->handleRegionEntry(regionId, regionType);
+	profiler->handleRegionEntry(regionId, regionType, getCallerStackPointer());
 }
 
 /**
@@ -368,11 +394,11 @@ void _KEnterRegion(SID regionId, RegionType regionType) {
  * @param regionType	Type of region being exited.
  */
 void _KExitRegion(SID regionId, RegionType regionType) {
-	profiler->handleRegionExit(regionId, regionType);
+	profiler->handleRegionExit(regionId, regionType, getCallerStackPointer());
 }
 
 void _KLandingPad(SID regionId, RegionType regionType) {
-	profiler->handleLandingPad(regionId, regionType);
+	profiler->handleLandingPad(regionId, regionType, getCallerStackPointer());
 }
 
 /*****************************************************************
@@ -464,6 +490,16 @@ void _KStoreConst(Addr dest_addr, UInt32 mem_access_size) {
 	profiler->handleStoreConst(dest_addr, mem_access_size);
 }
 
+void _KMemCopy(Addr dest_addr, Addr src_addr, UInt64 size) {
+	profiler->handleMemCopy(dest_addr, src_addr, size);
+}
+void _KMemSet(Reg src_reg, Addr dest_addr, UInt64 size) {
+	profiler->handleMemSet(src_reg, dest_addr, size);
+}
+void _KMemSetConst(Addr dest_addr, UInt64 size) {
+	profiler->handleMemSetConst(dest_addr, size);
+}
+
 /******************************************************************
  * KPhi Functions
  *
@@ -573,71 +609,24 @@ void _KCallLib(UInt cost, UInt dest, UInt num_in, ...) {
 
 /***********************************************
  * Dynamic Memory Allocation / Deallocation
- * DJ: will be optimized later..
  ************************************************/
 
-
-// FIXME: support 64 bit address
+// Blocks may be allocated or freed outside of any region (e.g. by a
+// destructor that runs after main has returned and the profiler is gone),
+// so these mustn't assume there is a profiler.
 void _KMalloc(Addr addr, size_t size, UInt dest) {
-	// TODO: idbgAction
-#if 0
-    if (!profiler->isEnabled()) return;
-    
-    MSG(1, "KMalloc addr=0x%x size=%llu\n", addr, (UInt64)size);
-
-    // Don't do anything if malloc returned NULL
-    if(!addr) { return; }
-
-    createMEntry(addr,size);
-#endif
+	if (profiler == NULL) return;
+	profiler->handleMalloc(addr, size);
 }
 
-// TODO: implement for new shadow mem interface
 void _KFree(Addr addr) {
-	// TODO: idbgAction
-#if 0
-    if (!profiler->isEnabled()) return;
-
-    MSG(1, "KFree addr=0x%x\n", addr);
-
-    // Calls to free with NULL just return.
-    if(addr == NULL) return;
-
-    size_t mem_size = getMEntry(addr);
-
-    Addr a;
-    for(a = addr; a < addr + mem_size; a++) {
-        GTableDeleteTEntry(gTable, a);
-	}
-
-    freeMEntry(addr);
-	_KWork(FREE_COST);
-	// make sure CP is at least the time needed to complete the free
-    int minLevel = profiler->getMinLevel();
-    int maxLevel = getEndLevel();
-
-    int i;
-    for (i = minLevel; i <= maxLevel; i++) {
-        UInt64 value = profiler->getControlDependenceAtIndex(i) + FREE_COST;
-
-        updateCP(value, i);
-    }
-#endif
+	if (profiler == NULL) return;
+	profiler->handleFree(addr);
 }
 
-// TODO: more efficient implementation (if old_addr = new_addr)
-// XXX: This is wrong. Values in the realloc'd location should still have the
-// same timestamp.
 void _KRealloc(Addr old_addr, Addr new_addr, size_t size, UInt dest) {
-	// TODO: idbgAction
-#if 0
-    if (!profiler->isEnabled())
-        return;
-
-    MSG(1, "KRealloc old_addr=0x%x new_addr=0x%x size=%llu\n", old_addr, new_addr, (UInt64)size);
-    _KFree(old_addr);
-    _KMalloc(new_addr,size,dest);
-#endif
+	if (profiler == NULL) return;
+	profiler->handleRealloc(old_addr, new_addr, size);
 }
 
 /***********************************************
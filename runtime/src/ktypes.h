@@ -45,5 +45,10 @@ typedef enum RegionType {RegionFunc, RegionLoop, RegionLoopBody} RegionType;
 #define KREM_PREP_REG_TABLE 16
 #define KREM_REDUCTION 17
 #define KREM_INDUCTION 18
+#define KREM_MALLOC 19
+#define KREM_FREE 20
+#define KREM_REALLOC 21
+#define KREM_MEMCOPY 22
+#define KREM_MEMSET 23
 
 #endif
@@ -280,6 +280,11 @@ static	void	*alloc_pages(mpool_t *mp_p, const unsigned int page_n,
 			}
 			return NULL;
 		}
+#ifdef MADV_HUGEPAGE
+		if (BIT_IS_SET(mp_p->mp_flags, MPOOL_FLAG_HUGE_PAGES)) {
+			(void)madvise(mem, size, MADV_HUGEPAGE);
+		}
+#endif
 		mp_p->mp_top += size;
 		if (mp_p->mp_addr != NULL) {
 			mp_p->mp_addr = (char *)mp_p->mp_addr + size;
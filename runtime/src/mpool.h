@@ -73,6 +73,14 @@ extern "C" {
  */
 #define MPOOL_FLAG_USE_SBRK		(1<<3)
 
+/*
+ * Ask the kernel to back mmapped pages with transparent huge pages.  Pick
+ * a page size that is a multiple of the huge page size for this to help.
+ * Ignored if the MPOOL_FLAG_USE_SBRK is enabled or madvise doesn't
+ * support it.
+ */
+#define MPOOL_FLAG_HUGE_PAGES		(1<<4)
+
 /*
  * Mpool error codes
  */
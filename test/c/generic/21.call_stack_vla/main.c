@@ -0,0 +1,33 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+// uses some stack of its own below the caller's VLA
+__attribute__ ((noinline)) int f1(int x) {
+	int local[4];
+	int i;
+	for(i = 0; i < 4; ++i) { local[i] = x + i; }
+	return local[rand() % 4];
+}
+
+// the VLA is allocated after the last region boundary of its frame, so its
+// shadow must survive the return from f1
+__attribute__ ((noinline)) int f2(int n) {
+	int vla[n];
+	int i;
+	for(i = 0; i < n; ++i) { vla[i] = rand(); }
+
+	int y = f1(n);
+
+	int sum = y;
+	for(i = 0; i < n; ++i) { sum += vla[i]; }
+	return sum;
+}
+
+int main() {
+	int n = 4 + rand() % 4;
+	int x = f2(n);
+
+	printf("x = %d\n",x);
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define N 1024
+
+int main() {
+	int i;
+
+	// memset with a constant and with a computed value
+	int* src = calloc(N,sizeof(int));
+	int* dest = malloc(N*sizeof(int));
+	memset(dest,0,N*sizeof(int));
+	memset(src,rand() % 2,N/2*sizeof(int));
+
+	for(i = N/2; i < N; ++i) { src[i] = rand(); }
+
+	// the copies depend on the stores to src, not on anything earlier in
+	// dest
+	memcpy(dest,src,N*sizeof(int));
+
+	// overlapping move
+	memmove(dest+1,dest,(N-1)*sizeof(int));
+
+	int sum = 0;
+	for(i = 0; i < N; ++i) { sum += dest[i]; }
+
+	printf("sum = %d\n",sum);
+
+	free(src);
+	free(dest);
+
+	return 0;
+}
@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+struct point {
+	int x;
+	int y;
+};
+
+// locals whose address never escapes, accessed only at constant positions
+__attribute__ ((noinline)) int f1(int a) {
+	int array[4];
+	struct point p;
+
+	array[0] = a;
+	array[1] = rand();
+	array[2] = array[0] + array[1];
+	array[3] = rand();
+
+	p.x = array[2];
+	p.y = array[3];
+
+	return p.x + p.y;
+}
+
+// indexed with a variable, so it stays in shadow memory
+__attribute__ ((noinline)) int f2(int a) {
+	int array[4];
+	int i;
+
+	for(i = 0; i < 4; ++i) { array[i] = a + rand(); }
+
+	return array[rand() % 4];
+}
+
+int main() {
+	int x = rand();
+
+	int y = f1(x);
+	int z = f2(y);
+
+	printf("y = %d, z = %d\n",y,z);
+
+	return 0;
+}